@@ -0,0 +1,47 @@
+#pragma once
+
+#include "esphome/core/automation.h"
+#include "hlk_ld2413.h"
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    template <typename... Ts>
+    class DumpTraceAction : public Action<Ts...>, public Parented<HLKLD2413Sensor>
+    {
+    public:
+      void play(Ts... x) override { this->parent_->dump_trace(); }
+    };
+
+    template <typename... Ts>
+    class StartCaptureAction : public Action<Ts...>, public Parented<HLKLD2413Sensor>
+    {
+    public:
+      void play(Ts... x) override { this->parent_->start_capture(); }
+    };
+
+    template <typename... Ts>
+    class StopCaptureAction : public Action<Ts...>, public Parented<HLKLD2413Sensor>
+    {
+    public:
+      void play(Ts... x) override { this->parent_->stop_capture(); }
+    };
+
+    template <typename... Ts>
+    class DumpCaptureAction : public Action<Ts...>, public Parented<HLKLD2413Sensor>
+    {
+    public:
+      void play(Ts... x) override { this->parent_->dump_capture(); }
+    };
+
+    template <typename... Ts>
+    class CalibrateAction : public Action<Ts...>, public Parented<HLKLD2413Sensor>
+    {
+    public:
+      void play(Ts... x) override { this->parent_->calibrate(); }
+    };
+
+  } // namespace hlk_ld2413
+} // namespace esphome
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    // Records raw UART reads with timestamps so a stream can be pulled from the
+    // device and replayed later. Layout (all integers little-endian):
+    //
+    //   "LDC1"                 4 byte magic
+    //   start time             uint32, millis() when the capture started
+    //   records...             one per UART read:
+    //     delta                varint, ms since the previous record (or start)
+    //     length               varint, number of bytes that follow
+    //     data                 the bytes as read from the UART
+    //
+    // Varints are LEB128: 7 bits per byte, high bit set on all but the last.
+    class CaptureBuffer
+    {
+    public:
+      static const size_t HEADER_SIZE = 8;
+
+      void set_size(size_t size) { this->size_ = size; }
+      size_t get_size() const { return this->size_; }
+      bool is_active() const { return this->active_; }
+      size_t get_length() const { return this->length_; }
+
+      bool start()
+      {
+        if (this->size_ <= HEADER_SIZE)
+          return false;
+
+        // Allocated on first use so an unused capture costs no RAM
+        if (!this->data_)
+        {
+          this->data_.reset(new uint8_t[this->size_]);
+        }
+
+        uint32_t now = millis();
+        memcpy(this->data_.get(), "LDC1", 4);
+        for (int i = 0; i < 4; i++)
+        {
+          this->data_[4 + i] = (now >> (8 * i)) & 0xFF;
+        }
+        this->length_ = HEADER_SIZE;
+        this->last_time_ = now;
+        this->active_ = true;
+        return true;
+      }
+
+      void stop() { this->active_ = false; }
+
+      // Returns false once the buffer is full, which also stops the capture
+      bool add(const uint8_t *data, size_t length)
+      {
+        if (!this->active_)
+          return true;
+
+        uint32_t now = millis();
+        uint8_t prefix[10];
+        size_t prefix_length = write_varint(prefix, now - this->last_time_);
+        prefix_length += write_varint(prefix + prefix_length, length);
+
+        if (this->length_ + prefix_length + length > this->size_)
+        {
+          this->active_ = false;
+          return false;
+        }
+
+        memcpy(this->data_.get() + this->length_, prefix, prefix_length);
+        memcpy(this->data_.get() + this->length_ + prefix_length, data, length);
+        this->length_ += prefix_length + length;
+        this->last_time_ = now;
+        return true;
+      }
+
+      // Logs the capture as hex, 32 bytes per line, between BEGIN/END markers.
+      // Strip everything but the hex and feed it to `xxd -r -p` to get the file.
+      void dump(const char *tag) const
+      {
+        if (!this->data_ || this->length_ == 0)
+        {
+          ESP_LOGI(tag, "Capture is empty");
+          return;
+        }
+
+        ESP_LOGI(tag, "CAPTURE BEGIN %u bytes", (unsigned) this->length_);
+        for (size_t offset = 0; offset < this->length_; offset += 32)
+        {
+          char line[32 * 2 + 1] = {0};
+          char *ptr = line;
+          for (size_t i = offset; i < offset + 32 && i < this->length_; i++)
+          {
+            ptr += sprintf(ptr, "%02X", this->data_[i]);
+          }
+          ESP_LOGI(tag, "capture: %s", line);
+          yield();
+        }
+        ESP_LOGI(tag, "CAPTURE END");
+      }
+
+    protected:
+      static size_t write_varint(uint8_t *out, uint32_t value)
+      {
+        size_t length = 0;
+        do
+        {
+          uint8_t byte = value & 0x7F;
+          value >>= 7;
+          out[length++] = byte | (value != 0 ? 0x80 : 0x00);
+        } while (value != 0);
+        return length;
+      }
+
+      std::unique_ptr<uint8_t[]> data_;
+      size_t size_{0};
+      size_t length_{0};
+      uint32_t last_time_{0};
+      bool active_{false};
+    };
+
+  } // namespace hlk_ld2413
+} // namespace esphome
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    // Frame layout shared by data frames and command ACKs (datasheet section 5):
+    //
+    //   header (4) | data length (2, LE) | data (data length) | footer (4)
+    //
+    // Headers and footers are compared as single 32-bit words. The words below are
+    // the datasheet byte sequences read as little-endian, which matches the ESP.
+    static const uint32_t DATA_HEADER_WORD = 0xF1F2F3F4; // F4 F3 F2 F1
+    static const uint32_t DATA_FOOTER_WORD = 0xF5F6F7F8; // F8 F7 F6 F5
+    static const uint32_t ACK_HEADER_WORD = 0xFAFBFCFD;  // FD FC FB FA
+    static const uint32_t ACK_FOOTER_WORD = 0x01020304;  // 04 03 02 01
+
+    static const size_t FRAME_OVERHEAD = 4 + 2 + 4; // header + length + footer
+    static const size_t FRAME_LENGTH_OFFSET = 4;
+    static const size_t FRAME_DATA_OFFSET = 6;
+
+    // ACKs echo the command word with this bit set
+    static const uint16_t ACK_COMMAND_FLAG = 0x0100;
+
+    enum FrameType : uint8_t
+    {
+      FRAME_UNKNOWN = 0,
+      FRAME_DATA,
+      FRAME_ACK,
+    };
+
+    inline uint32_t load_word(const uint8_t *data)
+    {
+      uint32_t word;
+      memcpy(&word, data, sizeof(word));
+      return word;
+    }
+
+    inline uint16_t load_half_word(const uint8_t *data) { return data[0] | (data[1] << 8); }
+
+    // Offset of the first byte that could start a data or ACK header, or length if
+    // there is none. memchr() skips the noise between frames far faster than a
+    // byte-by-byte compare.
+    inline size_t find_frame_start(const uint8_t *data, size_t length)
+    {
+      const uint8_t *data_start = static_cast<const uint8_t *>(memchr(data, DATA_HEADER_WORD & 0xFF, length));
+      size_t limit = data_start != nullptr ? data_start - data : length;
+      const uint8_t *ack_start = static_cast<const uint8_t *>(memchr(data, ACK_HEADER_WORD & 0xFF, limit));
+      return ack_start != nullptr ? ack_start - data : limit;
+    }
+
+    inline FrameType frame_type(uint32_t header)
+    {
+      if (header == DATA_HEADER_WORD)
+        return FRAME_DATA;
+      if (header == ACK_HEADER_WORD)
+        return FRAME_ACK;
+      return FRAME_UNKNOWN;
+    }
+
+    inline uint32_t frame_footer(FrameType type) { return type == FRAME_DATA ? DATA_FOOTER_WORD : ACK_FOOTER_WORD; }
+
+  } // namespace hlk_ld2413
+} // namespace esphome
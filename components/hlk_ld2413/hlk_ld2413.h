@@ -1,9 +1,19 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/gpio.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/uart/uart.h"
 #include "esphome/core/log.h"
+#ifdef USE_TIME
+#include "esphome/components/time/real_time_clock.h"
+#endif
+#include <algorithm>
+#include "level_trend.h"
+#include "trace_ring.h"
+#include "capture.h"
+#include "frame.h"
 
 namespace esphome
 {
@@ -12,11 +22,8 @@ namespace esphome
 
     static const char *const TAG = "hlk_ld2413";
 
-    // Protocol constants from datasheet section 5
-    // For reading data (device to ESP)
-    static const uint8_t FRAME_HEADER[4] = {0xF4, 0xF3, 0xF2, 0xF1};
-    static const uint8_t FRAME_END[4] = {0xF8, 0xF7, 0xF6, 0xF5};
-
+    // Protocol constants from datasheet section 5. Frames from the sensor are
+    // decoded in frame.h.
     // For sending commands (ESP to device)
     static const uint8_t COMMAND_HEADER[4] = {0xFD, 0xFC, 0xFB, 0xFA};
     static const uint8_t COMMAND_FOOTER[4] = {0x04, 0x03, 0x02, 0x01};
@@ -31,6 +38,39 @@ namespace esphome
     static const uint16_t CMD_SET_REPORT_CYCLE = 0x0071;
     static const uint16_t CMD_READ_REPORT_CYCLE = 0x0070;
 
+    // A command waiting in a sensor's queue
+    struct PendingCommand
+    {
+      uint16_t command;
+      uint8_t data[4];
+      uint8_t data_length;
+      const char *name;
+      uint16_t max_wait_time; // ms per attempt
+      uint8_t max_attempts;
+    };
+
+    enum DutyState : uint8_t
+    {
+      DUTY_OFF = 0, // Sensor powered down between samples
+      DUTY_WARMING, // Powered up, waiting for the first valid frame
+      DUTY_SAMPLING, // Gathering frames for one sample
+    };
+
+    // Last successful threshold calibration, kept in preferences
+    struct CalibrationRecord
+    {
+      uint32_t settings;  // min_distance | max_distance << 16 at the time of calibration
+      uint32_t timestamp; // UTC seconds, 0 if no time source was available
+    };
+
+    enum SetupState : uint8_t
+    {
+      SETUP_BOOT_WAIT = 0, // Waiting for the sensor to initialize
+      SETUP_CONFIGURING,   // Configuration commands in progress
+      SETUP_WAIT_FRAMES,   // Waiting for the first data frames
+      SETUP_DONE,
+    };
+
     class HLKLD2413Sensor : public sensor::Sensor, public PollingComponent, public uart::UARTDevice
     {
     public:
@@ -40,6 +80,46 @@ namespace esphome
       void set_max_distance(uint16_t max_distance) { this->max_distance_ = max_distance; }
       void set_report_cycle(uint16_t report_cycle) { this->report_cycle_ = report_cycle; }
       void set_calibrate_on_boot(bool calibrate_on_boot) { this->calibrate_on_boot_ = calibrate_on_boot; }
+      void set_rate_window(uint32_t rate_window) { this->trend_.set_time_constant(rate_window); }
+      void set_full_distance(uint16_t full_distance) { this->full_distance_ = full_distance; }
+      void set_empty_distance(uint16_t empty_distance) { this->empty_distance_ = empty_distance; }
+      void set_level_rate_sensor(sensor::Sensor *level_rate_sensor) { this->level_rate_sensor_ = level_rate_sensor; }
+      void set_time_to_full_sensor(sensor::Sensor *time_to_full_sensor) { this->time_to_full_sensor_ = time_to_full_sensor; }
+      void set_time_to_empty_sensor(sensor::Sensor *time_to_empty_sensor) { this->time_to_empty_sensor_ = time_to_empty_sensor; }
+      void set_frames_received_sensor(sensor::Sensor *frames_received_sensor) { this->frames_received_sensor_ = frames_received_sensor; }
+      void set_resyncs_sensor(sensor::Sensor *resyncs_sensor) { this->resyncs_sensor_ = resyncs_sensor; }
+      void set_bad_footers_sensor(sensor::Sensor *bad_footers_sensor) { this->bad_footers_sensor_ = bad_footers_sensor; }
+      void set_length_mismatches_sensor(sensor::Sensor *length_mismatches_sensor) { this->length_mismatches_sensor_ = length_mismatches_sensor; }
+      void set_out_of_range_sensor(sensor::Sensor *out_of_range_sensor) { this->out_of_range_sensor_ = out_of_range_sensor; }
+      void set_bytes_discarded_sensor(sensor::Sensor *bytes_discarded_sensor) { this->bytes_discarded_sensor_ = bytes_discarded_sensor; }
+      void set_frame_rate_sensor(sensor::Sensor *frame_rate_sensor) { this->frame_rate_sensor_ = frame_rate_sensor; }
+      void set_trace_size(size_t trace_size) { this->trace_.set_size(trace_size); }
+      void set_capture_size(size_t capture_size) { this->capture_.set_size(capture_size); }
+      void set_power_pin(GPIOPin *power_pin) { this->power_pin_ = power_pin; }
+      void set_frames_per_sample(uint8_t frames_per_sample) { this->frames_per_sample_ = frames_per_sample; }
+      void set_warmup_timeout(uint32_t warmup_timeout) { this->warmup_timeout_ = warmup_timeout; }
+      void set_calibration_interval(uint32_t calibration_interval) { this->calibration_interval_ = calibration_interval; }
+#ifdef USE_TIME
+      void set_time(time::RealTimeClock *time) { this->time_ = time; }
+      void set_calibration_hour(int8_t calibration_hour) { this->calibration_hour_ = calibration_hour; }
+#endif
+      void set_publish_on_change(float threshold, uint32_t min_interval, uint32_t max_interval)
+      {
+        this->publish_on_change_ = true;
+        this->change_threshold_ = threshold;
+        this->min_publish_interval_ = min_interval;
+        this->max_publish_interval_ = max_interval;
+      }
+      void set_adaptive_report_cycle(uint16_t fast_cycle, uint16_t slow_cycle, float moving_threshold,
+                                     float steady_threshold, uint32_t steady_time)
+      {
+        this->adaptive_report_cycle_ = true;
+        this->fast_report_cycle_ = fast_cycle;
+        this->slow_report_cycle_ = slow_cycle;
+        this->moving_threshold_ = moving_threshold;
+        this->steady_threshold_ = steady_threshold;
+        this->steady_time_ = steady_time;
+      }
 
       void setup() override
       {
@@ -52,49 +132,140 @@ namespace esphome
         this->last_buffer_check_ = millis();
         this->last_distance_ = 0;
         this->has_new_reading_ = false;
-
-        // Wait for the sensor to initialize properly
-        ESP_LOGI(TAG, "Waiting for sensor to initialize...");
-        for (int i = 0; i < 10; i++)
+        this->rx_length_ = 0;
+        this->in_sync_ = false;
+        this->frame_rate_time_ = millis();
+        this->active_report_cycle_ = this->report_cycle_;
+        this->steady_since_ = 0;
+        this->trend_.reset();
+        setup_calibration();
+
+        // In duty-cycle mode we own the sensor's power and start from the warm-up
+        // time learned on previous boots instead of a fixed wait
+        this->boot_wait_time_ = BOOT_WAIT_TIME;
+        if (this->power_pin_ != nullptr)
         {
-          delay(100);
-          yield();
+          this->power_pin_->setup();
+          this->warmup_pref_ = global_preferences->make_preference<uint32_t>(this->get_object_id_hash() ^ WARMUP_PREF_KEY);
+          uint32_t learned_warmup;
+          if (this->warmup_pref_.load(&learned_warmup) && learned_warmup > 0 && learned_warmup < this->warmup_timeout_)
+          {
+            this->learned_warmup_ = learned_warmup;
+            this->saved_warmup_ = learned_warmup;
+            this->boot_wait_time_ = learned_warmup;
+            ESP_LOGI(TAG, "Using learned warm-up time of %u ms", (unsigned) learned_warmup);
+          }
+          power_up();
         }
 
-        // Configure the sensor with the parameters
-        configure_sensor();
-        ESP_LOGI(TAG, "HLK-LD2413 setup complete");
-        yield();
+        // Wait for the sensor to initialize properly. The rest of the boot
+        // sequence runs from loop() so it doesn't hold up other components.
+        ESP_LOGI(TAG, "Waiting for sensor to initialize...");
+        this->setup_state_ = SETUP_BOOT_WAIT;
+        this->setup_state_since_ = millis();
       }
 
       void loop() override
       {
-        yield();
         if (available() > 0)
         {
           process_buffer(false);
         }
-        yield();
+        run_setup_state();
+        if (this->setup_state_ == SETUP_DONE)
+        {
+          run_calibration();
+          run_duty_cycle();
+          run_change_publish();
+        }
       }
 
       void dump_config() override
       {
         ESP_LOGCONFIG(TAG, "HLK-LD2413 Radar Sensor:");
         LOG_SENSOR("  ", "Distance", this);
+        if (this->firmware_version_[0] != 0 || this->firmware_version_[1] != 0 || this->firmware_version_[2] != 0)
+        {
+          ESP_LOGCONFIG(TAG, "  Firmware Version: %u.%u.%u", this->firmware_version_[0], this->firmware_version_[1],
+                        this->firmware_version_[2]);
+        }
         ESP_LOGCONFIG(TAG, "  Min Distance: %dmm", this->min_distance_);
         ESP_LOGCONFIG(TAG, "  Max Distance: %dmm", this->max_distance_);
         ESP_LOGCONFIG(TAG, "  Report Cycle: %dms", this->report_cycle_);
         ESP_LOGCONFIG(TAG, "  Calibrate on Boot: %s", this->calibrate_on_boot_ ? "Yes" : "No");
+        if (this->calibration_interval_ > 0)
+        {
+          ESP_LOGCONFIG(TAG, "  Calibration Interval: %us", (unsigned) this->calibration_interval_);
+        }
+#ifdef USE_TIME
+        if (this->calibration_hour_ >= 0)
+        {
+          ESP_LOGCONFIG(TAG, "  Calibration Hour: %d", this->calibration_hour_);
+        }
+#endif
+        LOG_SENSOR("  ", "Level Rate", this->level_rate_sensor_);
+        LOG_SENSOR("  ", "Time to Full", this->time_to_full_sensor_);
+        LOG_SENSOR("  ", "Time to Empty", this->time_to_empty_sensor_);
+        LOG_SENSOR("  ", "Frames Received", this->frames_received_sensor_);
+        LOG_SENSOR("  ", "Resyncs", this->resyncs_sensor_);
+        LOG_SENSOR("  ", "Bad Footers", this->bad_footers_sensor_);
+        LOG_SENSOR("  ", "Length Mismatches", this->length_mismatches_sensor_);
+        LOG_SENSOR("  ", "Out of Range", this->out_of_range_sensor_);
+        LOG_SENSOR("  ", "Bytes Discarded", this->bytes_discarded_sensor_);
+        LOG_SENSOR("  ", "Frame Rate", this->frame_rate_sensor_);
+        if (this->time_to_full_sensor_ != nullptr || this->time_to_empty_sensor_ != nullptr)
+        {
+          ESP_LOGCONFIG(TAG, "  Full Distance: %dmm", this->get_full_distance());
+          ESP_LOGCONFIG(TAG, "  Empty Distance: %dmm", this->get_empty_distance());
+        }
+        if (this->publish_on_change_)
+        {
+          ESP_LOGCONFIG(TAG, "  Publish on Change: %.1f mm", this->change_threshold_);
+          ESP_LOGCONFIG(TAG, "    Min Interval: %ums, Max Interval: %ums", (unsigned) this->min_publish_interval_,
+                        (unsigned) this->max_publish_interval_);
+        }
+        if (this->adaptive_report_cycle_)
+        {
+          ESP_LOGCONFIG(TAG, "  Adaptive Report Cycle: %dms moving / %dms steady", this->fast_report_cycle_, this->slow_report_cycle_);
+          ESP_LOGCONFIG(TAG, "    Moving Threshold: %.1f mm/min", this->moving_threshold_);
+          ESP_LOGCONFIG(TAG, "    Steady Threshold: %.1f mm/min for %ums", this->steady_threshold_, (unsigned) this->steady_time_);
+        }
+        if (this->power_pin_ != nullptr)
+        {
+          LOG_PIN("  Power Pin: ", this->power_pin_);
+          ESP_LOGCONFIG(TAG, "  Frames per Sample: %d", this->frames_per_sample_);
+          ESP_LOGCONFIG(TAG, "  Learned Warm-up: %u ms", (unsigned) this->learned_warmup_);
+        }
         LOG_UPDATE_INTERVAL(this);
         check_uart_settings(115200);
       }
 
       void update() override
       {
-        yield();
+        if (this->setup_state_ != SETUP_DONE)
+          return;
+
+        check_calibration_schedule();
+
+        // In duty-cycle mode each update takes one sample, published from loop()
+        if (this->power_pin_ != nullptr)
+        {
+          if (this->duty_state_ == DUTY_OFF)
+          {
+            power_up();
+          }
+          else
+          {
+            ESP_LOGW(TAG, "Previous sample still in progress, skipping this update");
+          }
+          publish_diagnostics();
+          return;
+        }
+
         process_buffer(true);
 
-        if (this->has_new_reading_)
+        // In publish-on-change mode the parser publishes, update() only watches the link
+        if (this->has_new_reading_ && !this->publish_on_change_)
         {
           publish_state(this->last_distance_);
           ESP_LOGI(TAG, "Published distance: %.1f mm", this->last_distance_);
@@ -106,116 +277,65 @@ namespace esphome
           if (now - this->last_successful_read_ > 5000)
           {
             ESP_LOGW(TAG, "No valid readings for over 5000 ms. Sensor may be disconnected or malfunctioning.");
-            if (available() > 0)
+            if (this->trace_.get_total_bytes() == this->trace_bytes_at_last_frame_)
             {
-              ESP_LOGW(TAG, "Buffer has data but no valid readings. Dumping for debugging:");
-              dump_buffer();
+              ESP_LOGW(TAG, "No data being received from sensor.");
             }
-            else
+            else if (!this->trace_dumped_)
             {
-              ESP_LOGW(TAG, "Buffer is empty. No data being received from sensor.");
+              // Once per outage, the trace doesn't change much between updates
+              ESP_LOGW(TAG, "Data is being received but no valid readings. Dumping trace for debugging:");
+              dump_trace();
+              this->trace_dumped_ = true;
             }
           }
         }
+
+        publish_rate_sensors();
+        publish_diagnostics();
         yield();
       }
 
-      // Dumps the contents of the buffer for debugging
-      void dump_buffer()
+      // Logs the recent bytes and parser events without touching the UART buffer
+      void dump_trace()
       {
-        int bytes_available = available();
-        if (bytes_available == 0)
+        if (this->trace_.get_size() == 0)
         {
-          ESP_LOGD(TAG, "Buffer is empty");
+          ESP_LOGI(TAG, "Trace is disabled (trace_size: 0), %u bytes received so far", (unsigned) this->trace_.get_total_bytes());
           return;
         }
+        this->trace_.dump(TAG);
+      }
 
-        int bytes_to_dump = std::min(bytes_available, 64);
-        ESP_LOGD(TAG, "Dumping %d bytes from buffer (total available: %d)", bytes_to_dump, bytes_available);
-
-        uint8_t buffer[64];
-        if (!read_array(buffer, bytes_to_dump))
+      // Starts recording raw UART reads, replacing any previous capture
+      void start_capture()
+      {
+        if (!this->capture_.start())
         {
-          ESP_LOGW(TAG, "Failed to read data from buffer");
+          ESP_LOGW(TAG, "Capture is disabled (capture_size too small)");
           return;
         }
+        ESP_LOGI(TAG, "Capture started (%u bytes available)", (unsigned) this->capture_.get_size());
+      }
 
-        // Log the buffer contents in chunks of 16 bytes
-        for (int i = 0; i < bytes_to_dump; i += 16)
-        {
-          yield();
-          int chunk_size = std::min(16, bytes_to_dump - i);
-          char log_str[100];
-          char *ptr = log_str;
-
-          for (int j = 0; j < chunk_size; j++)
-          {
-            ptr += sprintf(ptr, "%02X ", buffer[i + j]);
-          }
-
-          ESP_LOGD(TAG, "Buffer[%d-%d]: %s", i, i + chunk_size - 1, log_str);
-        }
-
-        // Check for data frame headers in the buffer
-        bool found_frame = false;
-        for (int i = 0; i < bytes_to_dump - 13; i++)
-        {
-          // Check for frame header
-          if (buffer[i] == FRAME_HEADER[0] &&
-              buffer[i + 1] == FRAME_HEADER[1] &&
-              buffer[i + 2] == FRAME_HEADER[2] &&
-              buffer[i + 3] == FRAME_HEADER[3])
-          {
-            found_frame = true;
-            ESP_LOGI(TAG, "Found data frame header at position %d", i);
+      void stop_capture()
+      {
+        this->capture_.stop();
+        ESP_LOGI(TAG, "Capture stopped with %u bytes", (unsigned) this->capture_.get_length());
+      }
 
-            // Check if we have enough bytes for a complete frame
-            if (i + 13 < bytes_to_dump)
-            {
-              uint16_t data_length = buffer[i + 4] | (buffer[i + 5] << 8);
-              ESP_LOGI(TAG, "Data frame length: %d", data_length);
-
-              // Check for frame end
-              if (buffer[i + 10] == FRAME_END[0] &&
-                  buffer[i + 11] == FRAME_END[1] &&
-                  buffer[i + 12] == FRAME_END[2] &&
-                  buffer[i + 13] == FRAME_END[3])
-              {
-                // Extract the float distance value
-                float distance;
-                memcpy(&distance, &buffer[i + 6], 4);
-
-                // Log the raw bytes of the distance
-                ESP_LOGI(TAG, "Distance bytes: %02X %02X %02X %02X",
-                         buffer[i + 6], buffer[i + 7], buffer[i + 8], buffer[i + 9]);
-                ESP_LOGI(TAG, "Found complete data frame with distance: %.1f mm", distance);
-
-                // Store the latest reading
-                this->last_distance_ = distance;
-                this->has_new_reading_ = true;
-                this->frames_received_++;
-                this->last_successful_read_ = millis();
-                break;
-              }
-              else
-              {
-                ESP_LOGW(TAG, "Found data frame header but end sequence doesn't match at position %d", i);
-                ESP_LOGW(TAG, "Expected: %02X %02X %02X %02X, Got: %02X %02X %02X %02X",
-                         FRAME_END[0], FRAME_END[1], FRAME_END[2], FRAME_END[3],
-                         buffer[i + 10], buffer[i + 11], buffer[i + 12], buffer[i + 13]);
-              }
-            }
-            else
-            {
-              ESP_LOGW(TAG, "Found data frame header but not enough bytes for complete frame");
-            }
-          }
-        }
+      void dump_capture() { this->capture_.dump(TAG); }
 
-        if (!found_frame)
+      // Calibrates the threshold in the background as soon as the sensor is idle
+      void calibrate()
+      {
+        if (this->calibrating_)
         {
-          ESP_LOGD(TAG, "No data frame headers found in buffer");
+          ESP_LOGW(TAG, "Calibration already in progress");
+          return;
         }
+        ESP_LOGI(TAG, "Calibration requested");
+        this->calibration_pending_ = true;
       }
 
     protected:
@@ -232,6 +352,132 @@ namespace esphome
       float last_distance_{0};
       bool has_new_reading_{false};
       bool calibrate_on_boot_{false};
+      uint16_t firmware_version_[3]{0, 0, 0}; // major, minor, patch; all 0 until read
+
+      // Boot sequence
+      static const uint32_t BOOT_WAIT_TIME = 1000;  // ms
+      static const uint32_t FRAME_WAIT_TIME = 2000; // ms
+      SetupState setup_state_{SETUP_BOOT_WAIT};
+      uint32_t setup_state_since_{0};
+      uint32_t setup_frame_count_{0};
+
+      // Power-gated duty cycle
+      static const uint32_t WARMUP_PREF_KEY = 0x4C443241;
+      static const uint8_t MAX_FRAMES_PER_SAMPLE = 16;
+      static const uint32_t WARMUP_SAVE_THRESHOLD = 50; // ms
+      static const uint8_t WARMUP_MARGIN_CYCLES = 2;    // Report cycles allowed on top of the learned warm-up
+      GPIOPin *power_pin_{nullptr};
+      DutyState duty_state_{DUTY_OFF};
+      uint8_t frames_per_sample_{5};
+      uint32_t warmup_timeout_{5000};  // ms
+      uint32_t boot_wait_time_{BOOT_WAIT_TIME};
+      uint32_t learned_warmup_{0};     // ms, 0 = not learned yet
+      uint32_t saved_warmup_{0};
+      uint32_t power_on_at_{0};
+      uint32_t warmup_window_{0};      // ms the current warm-up may take
+      bool warmup_missed_{false};      // The last warm-up ended without a frame
+      uint32_t sampling_since_{0};
+      float samples_[MAX_FRAMES_PER_SAMPLE];
+      uint8_t sample_count_{0};
+      bool sample_window_extended_{false}; // The first sampling window of this power cycle ended empty
+      ESPPreferenceObject warmup_pref_;
+
+      // Background calibration
+      static const uint32_t CALIBRATION_PREF_KEY = 0x43414C31;
+      static const uint32_t CALIBRATION_RETRY_DELAY = 3600000; // ms after a failed calibration
+      uint32_t calibration_interval_{0};                       // s, 0 = only on boot or on demand
+      bool calibration_pending_{false};
+      bool calibrating_{false};
+      bool calibration_recorded_{false}; // A calibration for the current settings is on record
+      uint32_t calibrated_at_{0};        // millis() of the last calibration, or of boot if it was before
+      uint32_t calibration_failed_at_{0};
+      bool calibration_failed_{false};
+      CalibrationRecord calibration_record_{0, 0};
+      ESPPreferenceObject calibration_pref_;
+#ifdef USE_TIME
+      time::RealTimeClock *time_{nullptr};
+      int8_t calibration_hour_{-1}; // local hour to calibrate in, -1 = any time
+#endif
+
+      // Command queue
+      static const size_t COMMAND_QUEUE_SIZE = 10;
+      static const uint32_t COMMAND_GAP = 50;          // ms between commands
+      static const uint32_t COMMAND_RETRY_DELAY = 100; // ms before a retry
+      PendingCommand command_queue_[COMMAND_QUEUE_SIZE];
+      size_t command_head_{0};
+      size_t command_count_{0};
+      uint8_t command_attempt_{0};
+      bool command_in_flight_{false};
+      uint32_t command_sent_at_{0};
+      uint32_t command_next_send_{0};
+      uint8_t tx_buffer_[32]; // Max expected packet size
+
+      // Streaming parser state
+      static const size_t RX_BUFFER_SIZE = 128;
+      static const uint16_t MAX_FRAME_DATA = RX_BUFFER_SIZE - FRAME_OVERHEAD;
+      static const uint16_t DATA_FRAME_PAYLOAD = 4; // float distance
+      static const int MAX_BYTES_PER_CALL = 512;
+      uint8_t rx_buffer_[RX_BUFFER_SIZE];
+      size_t rx_length_{0};
+      bool in_sync_{false};
+
+      // Frame accounting
+      uint32_t resyncs_{0};
+      uint32_t bad_footers_{0};
+      uint32_t length_mismatches_{0};
+      uint32_t out_of_range_{0};
+      uint32_t bytes_discarded_{0};
+      uint32_t frame_rate_time_{0};
+      uint32_t frame_rate_frames_{0};
+      sensor::Sensor *frames_received_sensor_{nullptr};
+      sensor::Sensor *resyncs_sensor_{nullptr};
+      sensor::Sensor *bad_footers_sensor_{nullptr};
+      sensor::Sensor *length_mismatches_sensor_{nullptr};
+      sensor::Sensor *out_of_range_sensor_{nullptr};
+      sensor::Sensor *bytes_discarded_sensor_{nullptr};
+      sensor::Sensor *frame_rate_sensor_{nullptr};
+
+      // Debug trace
+      TraceRing trace_;
+      uint32_t trace_bytes_at_last_frame_{0};
+      bool trace_dumped_{false};
+      CaptureBuffer capture_;
+
+      // Publish on change
+      bool publish_on_change_{false};
+      float change_threshold_{5.0f};       // mm
+      uint32_t min_publish_interval_{1000}; // ms
+      uint32_t max_publish_interval_{60000}; // ms, 0 = no heartbeat
+      uint32_t last_publish_time_{0};
+      float last_published_{NAN};
+      bool publish_held_{false}; // A change arrived inside min_publish_interval
+
+      // Adaptive report cycle
+      LevelTrend trend_;
+      bool adaptive_report_cycle_{false};
+      uint16_t fast_report_cycle_{50};    // ms
+      uint16_t slow_report_cycle_{1000};  // ms
+      uint16_t active_report_cycle_{DEFAULT_REPORT_CYCLE};
+      float moving_threshold_{30.0f};     // mm/min
+      float steady_threshold_{10.0f};     // mm/min
+      uint32_t steady_time_{60000};       // ms
+      uint32_t steady_since_{0};
+      static const uint32_t REPORT_CYCLE_RETRY_DELAY = 10000;      // ms after the first failed change
+      static const uint32_t MAX_REPORT_CYCLE_RETRY_DELAY = 600000; // ms
+      uint16_t failed_report_cycle_{0};   // Target of the last failed change, 0 = none
+      uint32_t report_cycle_failed_at_{0};
+      uint32_t report_cycle_retry_delay_{0}; // ms, doubles with every failure in a row
+
+      // Fill/drain rate and ETA
+      static constexpr float MIN_ETA_RATE = 1.0f; // mm/min, below this the level counts as not moving
+      uint16_t full_distance_{0};                 // mm, 0 = use min_distance
+      uint16_t empty_distance_{0};                // mm, 0 = use max_distance
+      sensor::Sensor *level_rate_sensor_{nullptr};
+      sensor::Sensor *time_to_full_sensor_{nullptr};
+      sensor::Sensor *time_to_empty_sensor_{nullptr};
+
+      uint16_t get_full_distance() const { return this->full_distance_ != 0 ? this->full_distance_ : this->min_distance_; }
+      uint16_t get_empty_distance() const { return this->empty_distance_ != 0 ? this->empty_distance_ : this->max_distance_; }
 
       // Helper function to log a hex buffer
       void log_hex_buffer(const uint8_t *buffer, size_t length, const char *prefix, int log_level = 0)
@@ -260,56 +506,19 @@ namespace esphome
         }
       }
 
-      // Helper function to check if a response is valid
-      bool is_valid_response(const uint8_t *buffer, size_t length, uint16_t expected_cmd, bool *status_ok = nullptr)
-      {
-        if (length < 14)
-          return false;
-
-        // Check header
-        if (buffer[0] != COMMAND_HEADER[0] || buffer[1] != COMMAND_HEADER[1] ||
-            buffer[2] != COMMAND_HEADER[2] || buffer[3] != COMMAND_HEADER[3])
-        {
-          return false;
-        }
-
-        // Check command
-        uint16_t cmd = buffer[6] | (buffer[7] << 8);
-        if (cmd != expected_cmd && buffer[6] != expected_cmd)
-        {
-          return false;
-        }
-
-        // Check status if requested
-        if (status_ok != nullptr)
-        {
-          uint16_t status = buffer[8] | (buffer[9] << 8);
-          *status_ok = (status == 0);
-        }
-
-        // Check footer
-        if (buffer[10] != COMMAND_FOOTER[0] || buffer[11] != COMMAND_FOOTER[1] ||
-            buffer[12] != COMMAND_FOOTER[2] || buffer[13] != COMMAND_FOOTER[3])
-        {
-          return false;
-        }
-
-        return true;
-      }
-
       // Send a command to the sensor
       void send_command(uint16_t command, const uint8_t *data = nullptr, uint16_t data_length = 0)
       {
-        static uint8_t buffer[32];                        // Max expected packet size
         size_t buffer_size = 4 + 2 + 2 + data_length + 4; // header + length + command + data + footer
 
-        if (buffer_size > sizeof(buffer))
+        if (buffer_size > sizeof(this->tx_buffer_))
         {
-          ESP_LOGE(TAG, "Command buffer overflow, needed %d bytes", buffer_size);
+          ESP_LOGE(TAG, "Command buffer overflow, needed %u bytes", (unsigned) buffer_size);
           return;
         }
 
         // Construct packet
+        uint8_t *buffer = this->tx_buffer_;
         memcpy(buffer, COMMAND_HEADER, 4);
 
         // Data length (2 bytes, little endian)
@@ -330,10 +539,6 @@ namespace esphome
         // Footer
         memcpy(buffer + 4 + 2 + 2 + data_length, COMMAND_FOOTER, 4);
 
-        // Clear any pending data before sending
-        flush();
-        delay(50);
-
         // Send command
         ESP_LOGD(TAG, "Sending command 0x%04X with %d bytes of data", command, data_length);
 
@@ -344,116 +549,221 @@ namespace esphome
         }
 
         this->write_array(buffer, buffer_size);
-        delay(100); // Give device time to respond
       }
 
-      // Send a command and wait for response
-      bool send_command_and_wait(uint16_t command, const uint8_t *data = nullptr, uint16_t data_length = 0,
-                                 const char *cmd_name = nullptr, uint32_t max_wait_time = 200, int max_attempts = 5)
+      // Queue a command. Commands are sent one at a time from loop(), each waiting
+      // for its ACK (or timing out) before the next goes out, so nothing blocks and
+      // several sensors can be configured at the same time.
+      bool queue_command(uint16_t command, const uint8_t *data, uint8_t data_length, const char *cmd_name,
+                         uint16_t max_wait_time = 200, uint8_t max_attempts = 5)
       {
-        if (cmd_name == nullptr)
+        if (data_length > sizeof(PendingCommand::data))
+        {
+          ESP_LOGE(TAG, "%s has %u bytes of data, at most %u fit, dropping it", cmd_name, (unsigned) data_length,
+                   (unsigned) sizeof(PendingCommand::data));
+          return false;
+        }
+        if (this->command_count_ >= COMMAND_QUEUE_SIZE)
         {
-          cmd_name = "command";
+          ESP_LOGE(TAG, "Command queue full, dropping %s", cmd_name);
+          return false;
         }
 
-        ESP_LOGI(TAG, "Sending %s (0x%04X)", cmd_name, command);
+        PendingCommand &pending = this->command_queue_[(this->command_head_ + this->command_count_) % COMMAND_QUEUE_SIZE];
+        pending.command = command;
+        if (data_length > 0)
+        {
+          memcpy(pending.data, data, data_length);
+        }
+        pending.data_length = data_length;
+        pending.name = cmd_name;
+        pending.max_wait_time = max_wait_time;
+        pending.max_attempts = max_attempts;
+        this->command_count_++;
+        return true;
+      }
+
+      // Send the command at the head of the queue, or retry it when its ACK is overdue
+      void run_command_queue()
+      {
+        if (this->command_count_ == 0)
+          return;
 
-        // Try multiple times
-        for (int attempt = 0; attempt < max_attempts; attempt++)
+        PendingCommand &pending = this->command_queue_[this->command_head_];
+        uint32_t now = millis();
+
+        if (!this->command_in_flight_)
         {
-          if (attempt > 0)
-          {
-            ESP_LOGW(TAG, "Retrying %s (attempt %d of %d)", cmd_name, attempt + 1, max_attempts);
-            delay(100);
-            flush();
-          }
+          if ((int32_t) (now - this->command_next_send_) < 0)
+            return;
 
-          // Prepare and send the command
-          if (data != nullptr && data_length > 0)
+          if (this->command_attempt_ > 0)
           {
-            send_command(command, data, data_length);
+            ESP_LOGW(TAG, "Retrying %s (attempt %d of %d)", pending.name, this->command_attempt_ + 1, pending.max_attempts);
           }
           else
           {
-            send_command(command);
+            ESP_LOGI(TAG, "Sending %s (0x%04X)", pending.name, pending.command);
           }
 
-          // Wait for response
-          uint32_t start_time = millis();
-          bool valid_ack_received = false;
+          send_command(pending.command, pending.data, pending.data_length);
+          this->command_in_flight_ = true;
+          this->command_sent_at_ = now;
+          return;
+        }
 
-          while (millis() - start_time < max_wait_time && !valid_ack_received)
-          {
-            int bytes_available = available();
-            if (bytes_available > 0)
-            {
-              ESP_LOGD(TAG, "Received response to %s (%d bytes)", cmd_name, bytes_available);
-
-              // Read response
-              uint8_t ack_buffer[20] = {0};
-              int bytes_to_read = std::min(bytes_available, 20);
-
-              if (read_array(ack_buffer, bytes_to_read))
-              {
-                log_hex_buffer(ack_buffer, bytes_to_read, "Response");
-
-                // Check if this is a valid ACK
-                bool status_ok = false;
-                if (is_valid_response(ack_buffer, bytes_to_read, command, &status_ok))
-                {
-                  if (status_ok)
-                  {
-                    ESP_LOGI(TAG, "Valid %s ACK received with SUCCESS status", cmd_name);
-                  }
-                  else
-                  {
-                    ESP_LOGW(TAG, "Valid %s ACK received with FAILURE status", cmd_name);
-                  }
-                  valid_ack_received = true;
-                  break;
-                }
-                // Check if this looks like a data frame
-                else if (bytes_to_read >= 4 &&
-                         ack_buffer[0] == FRAME_HEADER[0] &&
-                         ack_buffer[1] == FRAME_HEADER[1] &&
-                         ack_buffer[2] == FRAME_HEADER[2] &&
-                         ack_buffer[3] == FRAME_HEADER[3])
-                {
-                  if (command == CMD_EXIT_CONFIG_MODE)
-                  {
-                    ESP_LOGI(TAG, "Received data frame instead of ACK - sensor is already in data mode");
-                    valid_ack_received = true;
-                    break;
-                  }
-                  else
-                  {
-                    ESP_LOGW(TAG, "Received data frame instead of ACK - sensor may be in wrong mode");
-                  }
-                }
-                else
-                {
-                  ESP_LOGW(TAG, "Unexpected response format for %s", cmd_name);
-                }
-              }
-
-              // Flush any remaining data to start fresh
-              flush();
-            }
-            delay(10);
-          }
+        if (now - this->command_sent_at_ < pending.max_wait_time)
+          return;
 
-          // If we got a valid ACK, we're done
-          if (valid_ack_received)
+        // No ACK in time
+        retry_command();
+      }
+
+      // Count a failed attempt at the command in flight and schedule a retry, or
+      // give up on it once it is out of attempts
+      void retry_command()
+      {
+        PendingCommand &pending = this->command_queue_[this->command_head_];
+        this->command_in_flight_ = false;
+        this->command_attempt_++;
+        this->command_next_send_ = millis() + COMMAND_RETRY_DELAY;
+        if (this->command_attempt_ < pending.max_attempts)
+          return;
+
+        ESP_LOGW(TAG, "Failed to execute %s after %d attempts, continuing anyway", pending.name, pending.max_attempts);
+        complete_command(false);
+      }
+
+      // Pop the command at the head of the queue
+      void complete_command(bool success)
+      {
+        PendingCommand &pending = this->command_queue_[this->command_head_];
+        if (success)
+        {
+          ESP_LOGI(TAG, "%s successful", pending.name);
+          if (pending.command == CMD_SET_REPORT_CYCLE)
           {
-            ESP_LOGI(TAG, "%s successful", cmd_name);
-            delay(50); // Short delay to stabilize
-            return true;
+            this->active_report_cycle_ = pending.data[0] | (pending.data[1] << 8);
+            this->failed_report_cycle_ = 0;
+            this->report_cycle_retry_delay_ = 0;
           }
         }
+        else if (pending.command == CMD_SET_REPORT_CYCLE)
+        {
+          report_cycle_failed(pending.data[0] | (pending.data[1] << 8));
+        }
+        if (pending.command == CMD_UPDATE_THRESHOLD)
+        {
+          finish_calibration(success);
+        }
+
+        this->command_head_ = (this->command_head_ + 1) % COMMAND_QUEUE_SIZE;
+        this->command_count_--;
+        this->command_attempt_ = 0;
+        this->command_in_flight_ = false;
+        this->command_next_send_ = millis() + COMMAND_GAP; // Short delay to stabilize
+      }
+
+      // Match an ACK from the parser against the command waiting for it. The data
+      // is everything between the length field and the footer: the echoed command
+      // word followed by a command-specific payload.
+      void handle_ack(const uint8_t *data, uint16_t length)
+      {
+        if (!this->command_in_flight_)
+        {
+          ESP_LOGD(TAG, "Ignoring ACK with no command in flight");
+          return;
+        }
+
+        PendingCommand &pending = this->command_queue_[this->command_head_];
+        uint16_t ack_command = length >= 2 ? load_half_word(data) : 0xFFFF;
+
+        // The sensor sets ACK_COMMAND_FLAG in the echo, some firmware only echoes the low byte
+        if (length < 2 || (ack_command & 0xFF) != (pending.command & 0xFF))
+        {
+          log_hex_buffer(data, length, "Response");
+          ESP_LOGW(TAG, "Unexpected response 0x%04X for %s", ack_command, pending.name);
+          return;
+        }
+
+        // Read commands return their value in place of a status
+        if (pending.command == CMD_READ_FIRMWARE_VERSION)
+        {
+          handle_firmware_version(data + 2, length - 2);
+          complete_command(true);
+          return;
+        }
+        if (pending.command == CMD_READ_REPORT_CYCLE)
+        {
+          handle_report_cycle(data + 2, length - 2);
+          complete_command(true);
+          return;
+        }
+
+        if (length < 4)
+        {
+          log_hex_buffer(data, length, "Response");
+          ESP_LOGW(TAG, "%s ACK is missing its status", pending.name);
+          return;
+        }
+
+        uint16_t status = load_half_word(data + 2);
+        if (status != 0)
+        {
+          ESP_LOGW(TAG, "%s ACK received with FAILURE status 0x%04X", pending.name, status);
+          retry_command();
+          return;
+        }
+        ESP_LOGI(TAG, "Valid %s ACK received with SUCCESS status", pending.name);
+        complete_command(true);
+      }
 
-        // If we get here, we failed after multiple attempts
-        ESP_LOGW(TAG, "Failed to execute %s after %d attempts, continuing anyway", cmd_name, max_attempts);
-        return true; // Return true anyway to allow configuration to proceed
+      // Payload: major, minor, patch as 16-bit words
+      void handle_firmware_version(const uint8_t *payload, uint16_t length)
+      {
+        if (length < 6)
+        {
+          ESP_LOGW(TAG, "Firmware version ACK too short (%d bytes)", length);
+          return;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+          this->firmware_version_[i] = load_half_word(payload + 2 * i);
+        }
+        ESP_LOGI(TAG, "Firmware version: %u.%u.%u", this->firmware_version_[0], this->firmware_version_[1],
+                 this->firmware_version_[2]);
+      }
+
+      // Payload: report cycle in ms as a 32-bit word
+      void handle_report_cycle(const uint8_t *payload, uint16_t length)
+      {
+        if (length < 4)
+        {
+          ESP_LOGW(TAG, "Report cycle ACK too short (%d bytes)", length);
+          return;
+        }
+        uint32_t cycle = load_word(payload);
+        if (cycle != this->active_report_cycle_)
+        {
+          ESP_LOGW(TAG, "Sensor reports a %u ms report cycle, expected %d ms", (unsigned) cycle, this->active_report_cycle_);
+        }
+        else
+        {
+          ESP_LOGD(TAG, "Report cycle confirmed at %u ms", (unsigned) cycle);
+        }
+        this->active_report_cycle_ = cycle;
+      }
+
+      // Read the firmware version
+      bool read_firmware_version()
+      {
+        return queue_command(CMD_READ_FIRMWARE_VERSION, nullptr, 0, "read firmware version");
+      }
+
+      // Read back the report cycle
+      bool read_report_cycle()
+      {
+        return queue_command(CMD_READ_REPORT_CYCLE, nullptr, 0, "read report cycle");
       }
 
       // Enter configuration mode
@@ -461,175 +771,519 @@ namespace esphome
       {
         // Command value: 0x0001 (little endian)
         uint8_t cmd_value[2] = {0x01, 0x00};
-        return send_command_and_wait(CMD_ENTER_CONFIG_MODE, cmd_value, 2, "enter config mode", 200, 5);
+        return queue_command(CMD_ENTER_CONFIG_MODE, cmd_value, 2, "enter config mode", 200, 5);
       }
 
       // Exit configuration mode
       bool exit_config_mode()
       {
-        bool result = send_command_and_wait(CMD_EXIT_CONFIG_MODE, nullptr, 0, "exit config mode", 200, 5);
-
         // After exiting configuration mode, the sensor should start sending data frames
-        ESP_LOGI(TAG, "Waiting for sensor to transition to data mode...");
-        delay(200); // Reduced from 500ms to avoid watchdog
-
-        return result;
+        return queue_command(CMD_EXIT_CONFIG_MODE, nullptr, 0, "exit config mode", 200, 5);
       }
 
       // Set minimum detection distance
       bool set_min_detection_distance(uint16_t distance_mm)
       {
+        ESP_LOGD(TAG, "Queueing min distance of %d mm", distance_mm);
         uint8_t distance_bytes[2];
         distance_bytes[0] = distance_mm & 0xFF;
         distance_bytes[1] = (distance_mm >> 8) & 0xFF;
 
-        char cmd_name[40];
-        snprintf(cmd_name, sizeof(cmd_name), "set min distance to %d mm", distance_mm);
-
-        return send_command_and_wait(CMD_SET_MIN_DISTANCE, distance_bytes, 2, cmd_name);
+        return queue_command(CMD_SET_MIN_DISTANCE, distance_bytes, 2, "set min distance");
       }
 
       // Set maximum detection distance
       bool set_max_detection_distance(uint16_t distance_mm)
       {
+        ESP_LOGD(TAG, "Queueing max distance of %d mm", distance_mm);
         uint8_t distance_bytes[2];
         distance_bytes[0] = distance_mm & 0xFF;
         distance_bytes[1] = (distance_mm >> 8) & 0xFF;
 
-        char cmd_name[40];
-        snprintf(cmd_name, sizeof(cmd_name), "set max distance to %d mm", distance_mm);
-
-        return send_command_and_wait(CMD_SET_MAX_DISTANCE, distance_bytes, 2, cmd_name);
+        return queue_command(CMD_SET_MAX_DISTANCE, distance_bytes, 2, "set max distance");
       }
 
       // Set reporting cycle
       bool set_reporting_cycle_config(uint16_t cycle_ms)
       {
+        ESP_LOGD(TAG, "Queueing reporting cycle of %d ms", cycle_ms);
         uint8_t cycle_bytes[2];
         cycle_bytes[0] = cycle_ms & 0xFF;
         cycle_bytes[1] = (cycle_ms >> 8) & 0xFF;
 
-        char cmd_name[40];
-        snprintf(cmd_name, sizeof(cmd_name), "set reporting cycle to %d ms", cycle_ms);
-
-        return send_command_and_wait(CMD_SET_REPORT_CYCLE, cycle_bytes, 2, cmd_name);
+        return queue_command(CMD_SET_REPORT_CYCLE, cycle_bytes, 2, "set reporting cycle");
       }
 
       // Perform threshold calibration
       bool calibrate_threshold()
       {
-        // Calibration needs more time and may need multiple attempts
-        return send_command_and_wait(CMD_UPDATE_THRESHOLD, nullptr, 0, "threshold calibration", 500, 5);
+        // Calibration needs more time to ACK
+        return queue_command(CMD_UPDATE_THRESHOLD, nullptr, 0, "threshold calibration", 500, 5);
       }
 
-      // Configure the sensor with the current settings
-      bool configure_sensor()
-      {
-        ESP_LOGI(TAG, "Configuring HLK-LD2413 sensor...");
-        bool success = true;
+      uint32_t calibration_settings() const { return this->min_distance_ | ((uint32_t) this->max_distance_ << 16); }
 
-        // Enter config mode
-        bool config_mode_result = enter_config_mode();
-        if (!config_mode_result)
+      // Load the last calibration and decide whether calibrate_on_boot still has
+      // anything to do. The sensor keeps its threshold across power cycles, so a
+      // calibration for the same distances doesn't need repeating on every boot.
+      void setup_calibration()
+      {
+        this->calibration_pref_ = global_preferences->make_preference<CalibrationRecord>(this->get_object_id_hash() ^ CALIBRATION_PREF_KEY);
+        CalibrationRecord record;
+        if (this->calibration_pref_.load(&record) && record.settings == calibration_settings())
         {
-          ESP_LOGE(TAG, "Failed to enter config mode");
-          return false;
+          this->calibration_record_ = record;
+          this->calibration_recorded_ = true;
+          this->calibrated_at_ = millis();
         }
 
-        // Set min detection distance
-        bool min_distance_result = set_min_detection_distance(this->min_distance_);
-        if (!min_distance_result)
+        if (!this->calibrate_on_boot_)
+          return;
+        if (this->calibration_recorded_)
         {
-          ESP_LOGW(TAG, "Failed to set min detection distance");
-          success = false;
+          ESP_LOGI(TAG, "Sensor already calibrated for these distances, skipping boot calibration");
+          return;
         }
+        this->calibration_pending_ = true;
+      }
 
-        // Set max detection distance
-        bool max_distance_result = set_max_detection_distance(this->max_distance_);
-        if (!max_distance_result)
+      // Flag a calibration once the interval since the last one has passed
+      void check_calibration_schedule()
+      {
+        if (this->calibration_interval_ == 0 || this->calibration_pending_ || this->calibrating_)
+          return;
+
+        uint32_t now = millis();
+        if (this->calibration_failed_ && now - this->calibration_failed_at_ < CALIBRATION_RETRY_DELAY)
+          return;
+
+        bool due = !this->calibration_recorded_ || (now - this->calibrated_at_) / 1000 >= this->calibration_interval_;
+#ifdef USE_TIME
+        if (this->time_ != nullptr)
         {
-          ESP_LOGW(TAG, "Failed to set max detection distance");
-          success = false;
+          ESPTime time = this->time_->now();
+          if (!time.is_valid())
+            return;
+          // Wall clock age survives reboots, uptime doesn't
+          if (this->calibration_recorded_ && this->calibration_record_.timestamp != 0)
+          {
+            due = (uint32_t) time.timestamp - this->calibration_record_.timestamp >= this->calibration_interval_;
+          }
+          if (this->calibration_hour_ >= 0 && time.hour != this->calibration_hour_)
+            return;
         }
-
-        // Set reporting cycle
-        bool report_cycle_result = set_reporting_cycle_config(this->report_cycle_);
-        if (!report_cycle_result)
+#endif
+        if (due)
         {
-          ESP_LOGW(TAG, "Failed to set reporting cycle");
-          success = false;
+          ESP_LOGI(TAG, "Calibration due");
+          this->calibration_pending_ = true;
         }
+      }
 
-        // Only calibrate if calibrate_on_boot is enabled
-        if (this->calibrate_on_boot_)
+      // Start a pending calibration once the sensor is idle. In duty-cycle mode
+      // that is while it is powered for a sample, which is paused meanwhile.
+      void run_calibration()
+      {
+        if (this->calibrating_)
         {
-          // Calibrate threshold
-          bool calibrate_result = calibrate_threshold();
-          if (!calibrate_result)
+          if (this->command_count_ > 0)
+            return;
+          this->calibrating_ = false;
+          if (this->duty_state_ == DUTY_SAMPLING)
           {
-            ESP_LOGW(TAG, "First calibration attempt failed, trying once more");
-            delay(200);
-
-            // Try calibration one more time
-            calibrate_result = calibrate_threshold();
-            if (!calibrate_result)
+            if (this->sample_count_ >= this->frames_per_sample_)
             {
-              ESP_LOGW(TAG, "Failed to calibrate threshold after two attempts");
-              success = false;
+              finish_sample();
+            }
+            else
+            {
+              this->sampling_since_ = millis();
             }
           }
+          return;
         }
-        else
+
+        if (!this->calibration_pending_ || this->command_count_ > 0)
+          return;
+        if (this->power_pin_ != nullptr && this->duty_state_ != DUTY_SAMPLING)
+          return;
+
+        ESP_LOGI(TAG, "Starting threshold calibration");
+        this->calibration_pending_ = false;
+        this->calibrating_ = true;
+        enter_config_mode();
+        calibrate_threshold();
+        exit_config_mode();
+      }
+
+      void finish_calibration(bool success)
+      {
+        if (!success)
         {
-          ESP_LOGI(TAG, "Skipping calibration as calibrate_on_boot is disabled");
+          ESP_LOGW(TAG, "Threshold calibration failed, will try again later");
+          this->calibration_failed_ = true;
+          this->calibration_failed_at_ = millis();
+          return;
         }
 
-        // Exit config mode
-        bool exit_config_result = exit_config_mode();
-        if (!exit_config_result)
+        this->calibration_failed_ = false;
+        this->calibration_recorded_ = true;
+        this->calibrated_at_ = millis();
+        this->calibration_record_.settings = calibration_settings();
+        this->calibration_record_.timestamp = 0;
+#ifdef USE_TIME
+        if (this->time_ != nullptr)
         {
-          ESP_LOGE(TAG, "Failed to exit config mode");
-          return false;
+          ESPTime time = this->time_->now();
+          if (time.is_valid())
+          {
+            this->calibration_record_.timestamp = time.timestamp;
+          }
         }
+#endif
+        this->calibration_pref_.save(&this->calibration_record_);
+      }
 
-        // Wait for data frames to start coming in
-        ESP_LOGI(TAG, "Waiting for data frames...");
+      // Publish the level rate and fill/drain ETAs from the running trend fit. The
+      // fit sees every frame, so this is far more accurate than differentiating
+      // the decimated published values downstream.
+      void publish_rate_sensors()
+      {
+        if (this->level_rate_sensor_ == nullptr && this->time_to_full_sensor_ == nullptr &&
+            this->time_to_empty_sensor_ == nullptr)
+          return;
 
-        // Store current frame count to check if dump_buffer finds any frames
-        int initial_frame_count = this->frames_received_;
+        if (!this->trend_.is_valid())
+          return;
 
-        // Check for data frames
-        bool data_frames_received = false;
-        int check_count = 0;
-        const int max_checks = 20; // Limit checks to avoid watchdog reset
+        // Distance shrinks as the level rises, so flip the sign
+        float level_rate = -this->trend_.slope() * 60.0f; // mm/min
+        float distance = this->trend_.value();
 
-        while (!data_frames_received && check_count < max_checks)
+        if (this->level_rate_sensor_ != nullptr)
         {
-          yield();
-          dump_buffer();
+          this->level_rate_sensor_->publish_state(level_rate);
+        }
 
-          // Check if dump_buffer found any frames (frame count increased)
-          if (this->frames_received_ > initial_frame_count)
+        if (this->time_to_full_sensor_ != nullptr)
+        {
+          float minutes = NAN;
+          if (level_rate >= MIN_ETA_RATE)
           {
-            data_frames_received = true;
-            ESP_LOGI(TAG, "Data frames detected! Configuration successful.");
-            break;
+            minutes = std::max(0.0f, distance - this->get_full_distance()) / level_rate;
           }
+          this->time_to_full_sensor_->publish_state(minutes);
+        }
 
-          delay(100);
-          check_count++;
+        if (this->time_to_empty_sensor_ != nullptr)
+        {
+          float minutes = NAN;
+          if (level_rate <= -MIN_ETA_RATE)
+          {
+            minutes = std::max(0.0f, this->get_empty_distance() - distance) / -level_rate;
+          }
+          this->time_to_empty_sensor_->publish_state(minutes);
         }
 
-        if (!data_frames_received)
+        ESP_LOGD(TAG, "Level rate: %.1f mm/min", level_rate);
+      }
+
+      // Change the report cycle while running, leaving all other settings untouched
+      bool apply_report_cycle(uint16_t cycle_ms)
+      {
+        ESP_LOGD(TAG, "Changing report cycle from %d ms to %d ms", this->active_report_cycle_, cycle_ms);
+        return enter_config_mode() && set_reporting_cycle_config(cycle_ms) && exit_config_mode();
+      }
+
+      // Hold off changing to a report cycle the sensor just refused, for longer
+      // with every failure in a row, so the governor doesn't keep the sensor in
+      // config mode on every frame
+      void report_cycle_failed(uint16_t cycle_ms)
+      {
+        this->failed_report_cycle_ = cycle_ms;
+        this->report_cycle_failed_at_ = millis();
+        this->report_cycle_retry_delay_ = this->report_cycle_retry_delay_ == 0
+                                              ? REPORT_CYCLE_RETRY_DELAY
+                                              : std::min(2 * this->report_cycle_retry_delay_, MAX_REPORT_CYCLE_RETRY_DELAY);
+        ESP_LOGW(TAG, "Report cycle change to %d ms failed, not retrying for %u s", cycle_ms,
+                 (unsigned) (this->report_cycle_retry_delay_ / 1000));
+      }
+
+      bool report_cycle_backed_off(uint16_t cycle_ms, uint32_t now) const
+      {
+        return cycle_ms == this->failed_report_cycle_ && now - this->report_cycle_failed_at_ < this->report_cycle_retry_delay_;
+      }
+
+      // Switch to the fast report cycle while the level is moving and back to the
+      // slow one once it has been steady for a while. The gap between the two
+      // thresholds plus the steady time keep it from flapping. Runs on every frame,
+      // so a fill is caught as soon as the trend shows it rather than on the next
+      // update.
+      void update_report_cycle_governor()
+      {
+        // Wait for any previous change to finish
+        if (!this->adaptive_report_cycle_ || this->setup_state_ != SETUP_DONE || !this->trend_.is_valid() ||
+            this->command_count_ > 0)
+          return;
+
+        uint32_t now = millis();
+        float rate = fabsf(this->trend_.slope()) * 60.0f; // mm/min
+
+        if (rate >= this->moving_threshold_)
         {
-          ESP_LOGW(TAG, "No complete data frames found after %d checks. Configuration may not be successful.", check_count);
-          success = false;
+          this->steady_since_ = 0;
+          if (this->active_report_cycle_ != this->fast_report_cycle_ &&
+              !report_cycle_backed_off(this->fast_report_cycle_, now))
+          {
+            ESP_LOGI(TAG, "Level moving at %.1f mm/min, switching report cycle to %d ms", rate, this->fast_report_cycle_);
+            apply_report_cycle(this->fast_report_cycle_);
+          }
         }
+        else if (rate < this->steady_threshold_)
+        {
+          if (this->active_report_cycle_ == this->slow_report_cycle_)
+            return;
+          if (this->steady_since_ == 0)
+          {
+            this->steady_since_ = now;
+          }
+          else if (now - this->steady_since_ >= this->steady_time_ &&
+                   !report_cycle_backed_off(this->slow_report_cycle_, now))
+          {
+            ESP_LOGI(TAG, "Level steady at %.1f mm/min, switching report cycle to %d ms", rate, this->slow_report_cycle_);
+            apply_report_cycle(this->slow_report_cycle_);
+            this->steady_since_ = 0;
+          }
+        }
+        else
+        {
+          this->steady_since_ = 0;
+        }
+      }
 
+      // Queue the configuration sequence for the current settings
+      bool configure_sensor()
+      {
+        ESP_LOGI(TAG, "Configuring HLK-LD2413 sensor '%s'...", this->get_name().c_str());
+        bool success = enter_config_mode();
+        success &= read_firmware_version();
+        success &= set_min_detection_distance(this->min_distance_);
+        success &= set_max_detection_distance(this->max_distance_);
+        success &= set_reporting_cycle_config(this->report_cycle_);
+        success &= read_report_cycle();
+
+        // Calibration runs in the background once the sensor is measuring, see run_calibration()
+        success &= exit_config_mode();
         return success;
       }
 
-      // Processes the incoming data buffer looking for valid frames
+      // Step the boot sequence: wait for the sensor to power up, configure it, then
+      // wait for data frames. Runs from loop() so sensors on other UARTs boot in parallel.
+      void run_setup_state()
+      {
+        uint32_t now = millis();
+
+        switch (this->setup_state_)
+        {
+        case SETUP_BOOT_WAIT:
+          if (now - this->setup_state_since_ >= this->boot_wait_time_)
+          {
+            configure_sensor();
+            this->setup_state_ = SETUP_CONFIGURING;
+          }
+          break;
+
+        case SETUP_CONFIGURING:
+          run_command_queue();
+          if (this->command_count_ == 0)
+          {
+            ESP_LOGI(TAG, "Waiting for data frames...");
+            this->setup_state_ = SETUP_WAIT_FRAMES;
+            this->setup_state_since_ = now;
+            this->setup_frame_count_ = frames_decoded();
+          }
+          break;
+
+        case SETUP_WAIT_FRAMES:
+          if (frames_decoded() > this->setup_frame_count_)
+          {
+            ESP_LOGI(TAG, "Data frames detected on '%s'! Configuration successful.", this->get_name().c_str());
+            this->setup_state_ = SETUP_DONE;
+          }
+          else if (now - this->setup_state_since_ > FRAME_WAIT_TIME)
+          {
+            ESP_LOGW(TAG, "No complete data frames found on '%s' after %u ms. Configuration may not be successful.",
+                     this->get_name().c_str(), (unsigned) FRAME_WAIT_TIME);
+            this->setup_state_ = SETUP_DONE;
+          }
+
+          // The sensor keeps its settings, so it can sleep until the first update
+          if (this->setup_state_ == SETUP_DONE && this->power_pin_ != nullptr)
+          {
+            power_down();
+          }
+          break;
+
+        case SETUP_DONE:
+          run_command_queue();
+          break;
+        }
+      }
+
+      // Powers the sensor up for a sample
+      void power_up()
+      {
+        ESP_LOGD(TAG, "Powering up sensor");
+
+        // Whatever is left over belongs to the previous power cycle
+        this->rx_length_ = 0;
+        this->in_sync_ = false;
+
+        this->power_pin_->digital_write(true);
+        this->power_on_at_ = millis();
+        this->warmup_window_ = get_warmup_window();
+        this->duty_state_ = DUTY_WARMING;
+        this->sample_count_ = 0;
+        this->sample_window_extended_ = false;
+      }
+
+      void power_down()
+      {
+        ESP_LOGD(TAG, "Powering down sensor");
+        this->power_pin_->digital_write(false);
+        this->duty_state_ = DUTY_OFF;
+      }
+
+      // Called for every valid frame while powered in duty-cycle mode
+      void handle_duty_sample(float distance)
+      {
+        uint32_t now = millis();
+
+        if (this->duty_state_ == DUTY_WARMING)
+        {
+          learn_warmup(now - this->power_on_at_);
+          this->duty_state_ = DUTY_SAMPLING;
+          this->sampling_since_ = now;
+        }
+
+        // Frames seen while the sensor is being calibrated don't count
+        if (this->calibrating_)
+          return;
+
+        if (this->sample_count_ < MAX_FRAMES_PER_SAMPLE)
+        {
+          this->samples_[this->sample_count_++] = distance;
+        }
+
+        // Stay powered for a pending calibration, the sample is published after it
+        if (this->sample_count_ >= this->frames_per_sample_ && !this->calibration_pending_)
+        {
+          finish_sample();
+        }
+      }
+
+      // How long to wait for the first frame after power up. Once the warm-up time
+      // is known that plus half again and a couple of report cycles, since the
+      // first frame can come anywhere in a cycle. After a warm-up that ran past
+      // it the full timeout is allowed until a frame arrives, so a sensor that
+      // got slower is learned again rather than cut off every time.
+      uint32_t get_warmup_window() const
+      {
+        if (this->learned_warmup_ == 0 || this->warmup_missed_)
+          return this->warmup_timeout_;
+        uint32_t window = this->learned_warmup_ + this->learned_warmup_ / 2 + WARMUP_MARGIN_CYCLES * this->report_cycle_;
+        return std::min(window, this->warmup_timeout_);
+      }
+
+      // Keep a running average of the warm-up time and remember it across boots.
+      // Flash is only written when the value moves noticeably.
+      void learn_warmup(uint32_t warmup)
+      {
+        this->warmup_missed_ = false;
+        if (this->learned_warmup_ == 0)
+        {
+          this->learned_warmup_ = warmup;
+        }
+        else
+        {
+          this->learned_warmup_ = (3 * this->learned_warmup_ + warmup) / 4;
+        }
+        ESP_LOGD(TAG, "First frame %u ms after power up (learned warm-up %u ms)", (unsigned) warmup,
+                 (unsigned) this->learned_warmup_);
+
+        uint32_t change = this->learned_warmup_ > this->saved_warmup_ ? this->learned_warmup_ - this->saved_warmup_
+                                                                      : this->saved_warmup_ - this->learned_warmup_;
+        if (change > WARMUP_SAVE_THRESHOLD)
+        {
+          this->warmup_pref_.save(&this->learned_warmup_);
+          this->saved_warmup_ = this->learned_warmup_;
+        }
+      }
+
+      // Publish the median of the gathered frames and power down
+      void finish_sample()
+      {
+        power_down();
+        if (this->sample_count_ == 0)
+          return;
+
+        std::sort(this->samples_, this->samples_ + this->sample_count_);
+        float median = this->samples_[this->sample_count_ / 2];
+        if (this->sample_count_ % 2 == 0)
+        {
+          median = (median + this->samples_[this->sample_count_ / 2 - 1]) / 2.0f;
+        }
+
+        publish_state(median);
+        ESP_LOGI(TAG, "Published distance: %.1f mm (median of %d frames)", median, this->sample_count_);
+        this->has_new_reading_ = false;
+        publish_rate_sensors();
+      }
+
+      // Enforce the time limits of a duty cycle
+      void run_duty_cycle()
+      {
+        if (this->power_pin_ == nullptr || this->duty_state_ == DUTY_OFF || this->calibrating_)
+          return;
+
+        uint32_t now = millis();
+        if (this->duty_state_ == DUTY_WARMING && now - this->power_on_at_ > this->warmup_window_)
+        {
+          ESP_LOGW(TAG, "No valid frame within %u ms of power up, powering down", (unsigned) this->warmup_window_);
+          this->warmup_missed_ = true;
+          power_down();
+        }
+        else if (this->duty_state_ == DUTY_SAMPLING &&
+                 now - this->sampling_since_ > (uint32_t) this->frames_per_sample_ * this->report_cycle_ * 3 + 1000)
+        {
+          if (this->sample_count_ >= this->frames_per_sample_)
+          {
+            ESP_LOGW(TAG, "Pending calibration didn't start, publishing the sample without it");
+            finish_sample();
+          }
+          else if (this->sample_count_ > 0)
+          {
+            ESP_LOGW(TAG, "Only %d of %d frames received, publishing what we have", this->sample_count_, this->frames_per_sample_);
+            finish_sample();
+          }
+          else if (!this->sample_window_extended_)
+          {
+            // The sensor did come up, powering it down now would waste the warm-up
+            ESP_LOGW(TAG, "No frames in the sampling window, keeping the sensor powered for another");
+            this->sample_window_extended_ = true;
+            this->sampling_since_ = now;
+          }
+          else
+          {
+            ESP_LOGW(TAG, "No frames in two sampling windows, powering down without a sample");
+            power_down();
+          }
+        }
+      }
+
+      // Processes the incoming data buffer looking for valid frames. Bytes are kept
+      // in rx_buffer_ between calls so a frame split across two reads isn't lost,
+      // and every byte that doesn't end up in a good frame is accounted for.
       void process_buffer(bool should_publish = false)
       {
         if (available() == 0)
@@ -643,143 +1297,340 @@ namespace esphome
           ESP_LOGV(TAG, "Buffer has %d bytes available", bytes_available);
         }
 
-        // If buffer is getting too large, dump it for debugging but don't flush
         if (bytes_available > 256)
         {
-          ESP_LOGW(TAG, "Buffer large (%d bytes), dumping for debugging", bytes_available);
-          dump_buffer();
-          return; // Let dump_buffer handle it
+          ESP_LOGW(TAG, "Buffer large (%d bytes), parser is falling behind", bytes_available);
+          this->trace_.add_event(TRACE_BUFFER_LARGE, this->trace_.get_total_bytes());
         }
 
-        // Keep track of how many valid frames we found in this processing cycle
-        int valid_frames_found = 0;
-        int max_iterations = 10; // Reduced from 50 to avoid watchdog
-        int iterations = 0;
+        uint32_t frames_before = frames_decoded();
+        uint32_t errors_before = this->bad_footers_ + this->length_mismatches_;
+        int budget = MAX_BYTES_PER_CALL; // Bound the time spent here to avoid watchdog
+
+        while (budget > 0 && (bytes_available = available()) > 0)
+        {
+          size_t space = RX_BUFFER_SIZE - this->rx_length_;
+          size_t bytes_to_read = std::min<size_t>(std::min<size_t>(bytes_available, space), budget);
+
+          if (!read_array(this->rx_buffer_ + this->rx_length_, bytes_to_read))
+          {
+            ESP_LOGW(TAG, "Failed to read data from buffer");
+            return;
+          }
+          this->trace_.add_bytes(this->rx_buffer_ + this->rx_length_, bytes_to_read);
+          if (!this->capture_.add(this->rx_buffer_ + this->rx_length_, bytes_to_read))
+          {
+            ESP_LOGI(TAG, "Capture buffer full, capture stopped with %u bytes", (unsigned) this->capture_.get_length());
+          }
+          this->rx_length_ += bytes_to_read;
+          budget -= bytes_to_read;
 
-        // Read a chunk of data from the buffer
-        uint8_t buffer[64];
-        int bytes_to_read = std::min(bytes_available, 64);
+          parse_rx_buffer(should_publish);
+          yield();
+        }
 
-        if (!read_array(buffer, bytes_to_read))
+        // Log frame status if publishing
+        if (should_publish)
         {
-          ESP_LOGW(TAG, "Failed to read data from buffer");
-          return;
+          uint32_t valid_frames_found = frames_decoded() - frames_before;
+          uint32_t bad_frames_found = this->bad_footers_ + this->length_mismatches_ - errors_before;
+          if (valid_frames_found > 0)
+          {
+            ESP_LOGI(TAG, "Found %u valid frames in this processing cycle", (unsigned) valid_frames_found);
+          }
+          else if (bad_frames_found > 0)
+          {
+            ESP_LOGW(TAG, "Found data frame headers but no complete frames");
+          }
+          else
+          {
+            ESP_LOGD(TAG, "No data frame headers found in buffer");
+          }
         }
+      }
 
-        // Look for data frames in the buffer
-        bool found_frame = false;
-        bool found_complete_frame = false;
+      // Decodes as many frames as possible from rx_buffer_ and keeps any trailing
+      // partial frame for the next call. Data frames and command ACKs share the
+      // stream and the same layout, so both are sized by their length field.
+      void parse_rx_buffer(bool should_publish)
+      {
+        size_t pos = 0;
 
-        for (int i = 0; i < bytes_to_read - 13 && iterations < max_iterations; i++, iterations++)
+        while (pos < this->rx_length_)
         {
-          // Yield every few iterations to avoid watchdog reset
-          if (iterations % 3 == 0)
+          // Jump straight to the next byte that could start a header
+          size_t skip = find_frame_start(this->rx_buffer_ + pos, this->rx_length_ - pos);
+          if (skip > 0)
           {
-            yield();
+            discard_bytes(pos, skip);
+            pos += skip;
+            continue;
           }
 
-          // Check for frame header
-          if (buffer[i] == FRAME_HEADER[0] &&
-              buffer[i + 1] == FRAME_HEADER[1] &&
-              buffer[i + 2] == FRAME_HEADER[2] &&
-              buffer[i + 3] == FRAME_HEADER[3])
+          if (this->rx_length_ - pos < sizeof(DATA_HEADER_WORD))
+            break;
+
+          const uint8_t *frame = this->rx_buffer_ + pos;
+          FrameType type = frame_type(load_word(frame));
+          if (type == FRAME_UNKNOWN)
           {
-            found_frame = true;
+            discard_bytes(pos, 1);
+            pos++;
+            continue;
+          }
 
-            // Check if we have enough bytes for a complete frame
-            if (i + 13 < bytes_to_read)
-            {
-              uint16_t data_length = buffer[i + 4] | (buffer[i + 5] << 8);
-
-              // Check for frame end
-              if (buffer[i + 10] == FRAME_END[0] &&
-                  buffer[i + 11] == FRAME_END[1] &&
-                  buffer[i + 12] == FRAME_END[2] &&
-                  buffer[i + 13] == FRAME_END[3])
-              {
-                found_complete_frame = true;
-
-                // Extract the float distance value
-                float distance;
-                memcpy(&distance, &buffer[i + 6], 4);
-
-                // Update counters
-                this->frames_received_++;
-                this->last_successful_read_ = millis();
-                valid_frames_found++;
-
-                // Validate range
-                if (distance >= this->min_distance_ && distance <= this->max_distance_)
-                {
-                  // Store the latest reading
-                  this->last_distance_ = distance;
-                  this->has_new_reading_ = true;
-
-                  // Only log and publish if requested (during update)
-                  if (should_publish)
-                  {
-                    ESP_LOGI(TAG, "Distance updated: %.1f mm (frame #%d)", distance, this->frames_received_);
-                    break; // Exit the loop once we find a valid frame
-                  }
-                }
-                else
-                {
-                  ESP_LOGW(TAG, "Distance out of range: %.1f mm (min: %d, max: %d)",
-                           distance, this->min_distance_, this->max_distance_);
-
-                  // Special case: if distance is 0, publish it anyway
-                  // This allows detecting when no object is in range
-                  if (distance == 0.0f)
-                  {
-                    this->last_distance_ = 0.0f;
-                    this->has_new_reading_ = true;
-
-                    if (should_publish)
-                    {
-                      ESP_LOGI(TAG, "Publishing zero distance (no object detected)");
-                      break;
-                    }
-                  }
-                }
-              }
-              else if (should_publish)
-              {
-                ESP_LOGW(TAG, "Found data frame header but end sequence doesn't match");
-              }
-            }
-            else if (should_publish)
+          // Wait for the length field
+          if (this->rx_length_ - pos < FRAME_DATA_OFFSET)
+            break;
+
+          uint16_t data_length = load_half_word(frame + FRAME_LENGTH_OFFSET);
+          if (data_length > MAX_FRAME_DATA)
+          {
+            // Can't be a real frame, the header was a coincidence
+            this->length_mismatches_++;
+            trace_event(TRACE_LENGTH_MISMATCH, pos);
+            discard_bytes(pos, 1);
+            pos++;
+            continue;
+          }
+
+          // Wait for the rest of the frame
+          size_t frame_size = FRAME_OVERHEAD + data_length;
+          if (this->rx_length_ - pos < frame_size)
+            break;
+
+          if (load_word(frame + FRAME_DATA_OFFSET + data_length) != frame_footer(type))
+          {
+            this->bad_footers_++;
+            trace_event(TRACE_BAD_FOOTER, pos);
+            if (should_publish)
             {
-              ESP_LOGW(TAG, "Found data frame header but not enough bytes for complete frame");
+              ESP_LOGW(TAG, "Found %s header but end sequence doesn't match", type == FRAME_DATA ? "data frame" : "ACK");
             }
+            discard_bytes(pos, 1);
+            pos++;
+            continue;
+          }
+
+          if (type == FRAME_DATA)
+          {
+            handle_data_frame(frame + FRAME_DATA_OFFSET, data_length, pos, should_publish);
           }
+          else
+          {
+            trace_event(TRACE_ACK, pos);
+            handle_ack(frame + FRAME_DATA_OFFSET, data_length);
+          }
+          this->in_sync_ = true;
+          pos += frame_size;
         }
 
-        // Log frame status if publishing
-        if (should_publish)
+        // Keep the unparsed tail for the next call
+        if (pos > 0)
         {
-          if (valid_frames_found > 0)
+          this->rx_length_ -= pos;
+          memmove(this->rx_buffer_, this->rx_buffer_ + pos, this->rx_length_);
+        }
+      }
+
+      // Handles a complete data frame whose footer checked out
+      void handle_data_frame(const uint8_t *data, uint16_t length, size_t pos, bool should_publish)
+      {
+        if (length != DATA_FRAME_PAYLOAD)
+        {
+          // Well-formed but not a distance report, skip it as a whole
+          this->length_mismatches_++;
+          trace_event(TRACE_LENGTH_MISMATCH, pos);
+          if (should_publish)
           {
-            ESP_LOGI(TAG, "Found %d valid frames in this processing cycle", valid_frames_found);
+            ESP_LOGW(TAG, "Found data frame but length is %d instead of %d", length, DATA_FRAME_PAYLOAD);
           }
-          else
+          return;
+        }
+
+        // Extract the float distance value
+        float distance;
+        memcpy(&distance, data, 4);
+        bool in_range = handle_distance(distance, should_publish);
+        trace_event(in_range ? TRACE_FRAME : TRACE_OUT_OF_RANGE, pos);
+
+        // A data frame while waiting to leave config mode means we already have
+        if (this->command_in_flight_ && this->command_queue_[this->command_head_].command == CMD_EXIT_CONFIG_MODE)
+        {
+          ESP_LOGI(TAG, "Received data frame instead of ACK - sensor is already in data mode");
+          complete_command(true);
+        }
+      }
+
+      // Accounts for bytes dropped while hunting for a frame header
+      void discard_bytes(size_t pos, size_t count)
+      {
+        this->bytes_discarded_ += count;
+        if (this->in_sync_)
+        {
+          this->resyncs_++;
+          this->in_sync_ = false;
+          trace_event(TRACE_RESYNC, pos);
+        }
+      }
+
+      // Records a parser event at a position in rx_buffer_
+      void trace_event(TraceEvent event, size_t pos)
+      {
+        this->trace_.add_event(event, this->trace_.get_total_bytes() - (this->rx_length_ - pos));
+      }
+
+      // Data frames decoded, whether the distance was in range or not
+      uint32_t frames_decoded() const { return this->frames_received_ + this->out_of_range_; }
+
+      // Handles the distance from a complete, well-formed data frame. Returns
+      // false if the distance was out of range.
+      bool handle_distance(float distance, bool should_publish)
+      {
+        // Any frame shows the link is alive, only good ones count as received
+        this->last_successful_read_ = millis();
+        this->trace_bytes_at_last_frame_ = this->trace_.get_total_bytes();
+        this->trace_dumped_ = false;
+
+        // Validate range
+        if (distance >= this->min_distance_ && distance <= this->max_distance_)
+        {
+          this->frames_received_++;
+
+          // Store the latest reading
+          this->last_distance_ = distance;
+          this->has_new_reading_ = true;
+          this->trend_.add(this->last_successful_read_, distance);
+          update_report_cycle_governor();
+          if (this->power_pin_ != nullptr && this->duty_state_ != DUTY_OFF && this->setup_state_ == SETUP_DONE)
           {
-            if (!found_frame)
-            {
-              ESP_LOGD(TAG, "No data frame headers found in buffer");
-            }
-            else if (!found_complete_frame)
-            {
-              ESP_LOGW(TAG, "Found data frame headers but no complete frames");
-            }
+            handle_duty_sample(distance);
           }
+          check_change_publish();
 
-          if (iterations >= max_iterations)
+          // Only log if requested (during update)
+          if (should_publish)
           {
-            ESP_LOGW(TAG, "Hit iteration limit (%d) in process_buffer", max_iterations);
+            ESP_LOGI(TAG, "Distance updated: %.1f mm (frame #%u)", distance, (unsigned) this->frames_received_);
           }
+          return true;
         }
 
-        yield();
+        this->out_of_range_++;
+        if (should_publish)
+        {
+          ESP_LOGW(TAG, "Distance out of range: %.1f mm (min: %d, max: %d)",
+                   distance, this->min_distance_, this->max_distance_);
+        }
+
+        // Special case: if distance is 0, publish it anyway
+        // This allows detecting when no object is in range
+        if (distance == 0.0f)
+        {
+          this->last_distance_ = 0.0f;
+          this->has_new_reading_ = true;
+          check_change_publish();
+
+          if (should_publish)
+          {
+            ESP_LOGI(TAG, "Publishing zero distance (no object detected)");
+          }
+        }
+        return false;
+      }
+
+      // Publish the newest reading straight from the parser if it moved by at
+      // least change_threshold_ since the last publish. A change inside
+      // min_publish_interval_ is held back and released by run_change_publish().
+      void check_change_publish()
+      {
+        if (!this->publish_on_change_ || this->setup_state_ != SETUP_DONE)
+          return;
+
+        if (!changed_since_publish())
+          return;
+
+        if (millis() - this->last_publish_time_ < this->min_publish_interval_)
+        {
+          this->publish_held_ = true;
+          return;
+        }
+        publish_distance();
+      }
+
+      // Release held changes and send the heartbeat while the level is steady
+      void run_change_publish()
+      {
+        if (!this->publish_on_change_)
+          return;
+
+        uint32_t now = millis();
+        uint32_t since_publish = now - this->last_publish_time_;
+        if (this->publish_held_)
+        {
+          if (since_publish < this->min_publish_interval_)
+            return;
+          // The level may have settled back while the change was held
+          if (changed_since_publish())
+          {
+            publish_distance();
+          }
+          else
+          {
+            ESP_LOGV(TAG, "Held change is back within %.1f mm of %.1f mm, dropping it", this->change_threshold_,
+                     this->last_published_);
+            this->publish_held_ = false;
+          }
+        }
+        else if (this->max_publish_interval_ > 0 && since_publish >= this->max_publish_interval_ &&
+                 this->has_new_reading_)
+        {
+          // Only repeat values backed by a fresh frame, silence means the sensor is gone
+          publish_distance();
+        }
+      }
+
+      bool changed_since_publish() const
+      {
+        return std::isnan(this->last_published_) ||
+               fabsf(this->last_distance_ - this->last_published_) >= this->change_threshold_;
+      }
+
+      void publish_distance()
+      {
+        publish_state(this->last_distance_);
+        ESP_LOGD(TAG, "Published distance: %.1f mm", this->last_distance_);
+        this->last_published_ = this->last_distance_;
+        this->last_publish_time_ = millis();
+        this->publish_held_ = false;
+        this->has_new_reading_ = false;
+      }
+
+      // Publish the frame accounting counters
+      void publish_diagnostics()
+      {
+        uint32_t now = millis();
+        uint32_t elapsed = now - this->frame_rate_time_;
+        if (this->frame_rate_sensor_ != nullptr && elapsed > 0)
+        {
+          uint32_t frames = this->frames_received_ - this->frame_rate_frames_;
+          this->frame_rate_sensor_->publish_state(frames * 1000.0f / elapsed);
+        }
+        this->frame_rate_time_ = now;
+        this->frame_rate_frames_ = this->frames_received_;
+
+        if (this->frames_received_sensor_ != nullptr)
+          this->frames_received_sensor_->publish_state(this->frames_received_);
+        if (this->resyncs_sensor_ != nullptr)
+          this->resyncs_sensor_->publish_state(this->resyncs_);
+        if (this->bad_footers_sensor_ != nullptr)
+          this->bad_footers_sensor_->publish_state(this->bad_footers_);
+        if (this->length_mismatches_sensor_ != nullptr)
+          this->length_mismatches_sensor_->publish_state(this->length_mismatches_);
+        if (this->out_of_range_sensor_ != nullptr)
+          this->out_of_range_sensor_->publish_state(this->out_of_range_);
+        if (this->bytes_discarded_sensor_ != nullptr)
+          this->bytes_discarded_sensor_->publish_state(this->bytes_discarded_);
       }
     };
 
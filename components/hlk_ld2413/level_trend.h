@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    // Exponentially weighted least-squares line fit of distance against time.
+    // Each sample costs a handful of multiplies and one expf(). The origin of
+    // both axes is moved to the newest sample on every update, so the sums stay
+    // small and float precision holds no matter how long the sensor runs.
+    class LevelTrend
+    {
+    public:
+      void set_time_constant(uint32_t time_constant_ms) { this->time_constant_s_ = time_constant_ms / 1000.0f; }
+
+      void reset()
+      {
+        this->has_sample_ = false;
+        this->s0_ = this->sx_ = this->sy_ = this->sxx_ = this->sxy_ = 0.0f;
+      }
+
+      void add(uint32_t now, float value)
+      {
+        if (!this->has_sample_)
+        {
+          this->reset();
+          this->has_sample_ = true;
+          this->last_time_ = now;
+          this->last_value_ = value;
+          this->s0_ = 1.0f;
+          return;
+        }
+
+        float dt = (now - this->last_time_) / 1000.0f;
+        float dy = value - this->last_value_;
+
+        // A long gap means the old samples describe a different situation
+        if (dt > 5.0f * this->time_constant_s_)
+        {
+          this->has_sample_ = false;
+          this->add(now, value);
+          return;
+        }
+
+        // Age the existing samples
+        float w = expf(-dt / this->time_constant_s_);
+        this->s0_ *= w;
+        this->sx_ *= w;
+        this->sy_ *= w;
+        this->sxx_ *= w;
+        this->sxy_ *= w;
+
+        // Shift the origin to the new sample: x' = x - dt, y' = y - dy
+        this->sxx_ += -2.0f * dt * this->sx_ + dt * dt * this->s0_;
+        this->sxy_ += -dt * this->sy_ - dy * this->sx_ + dt * dy * this->s0_;
+        this->sx_ -= dt * this->s0_;
+        this->sy_ -= dy * this->s0_;
+
+        // The new sample sits at (0, 0) and only adds to the weight
+        this->s0_ += 1.0f;
+
+        this->last_time_ = now;
+        this->last_value_ = value;
+      }
+
+      // True once enough samples spread over enough time have been seen
+      bool is_valid() const
+      {
+        if (!this->has_sample_ || this->s0_ < MIN_WEIGHT)
+          return false;
+        float mean_x = this->sx_ / this->s0_;
+        float var_x = this->sxx_ / this->s0_ - mean_x * mean_x;
+        return var_x > MIN_TIME_VARIANCE;
+      }
+
+      // Rate of change in units per second
+      float slope() const
+      {
+        float denominator = this->s0_ * this->sxx_ - this->sx_ * this->sx_;
+        if (denominator <= 0.0f)
+          return 0.0f;
+        return (this->s0_ * this->sxy_ - this->sx_ * this->sy_) / denominator;
+      }
+
+      // Fitted value at the time of the newest sample
+      float value() const
+      {
+        if (this->s0_ <= 0.0f)
+          return this->last_value_;
+        float intercept = (this->sy_ - this->slope() * this->sx_) / this->s0_;
+        return this->last_value_ + intercept;
+      }
+
+    protected:
+      static constexpr float MIN_WEIGHT = 3.0f;
+      static constexpr float MIN_TIME_VARIANCE = 0.25f; // s^2
+
+      float time_constant_s_{10.0f};
+      bool has_sample_{false};
+      uint32_t last_time_{0};
+      float last_value_{0};
+      float s0_{0};
+      float sx_{0};
+      float sy_{0};
+      float sxx_{0};
+      float sxy_{0};
+    };
+
+  } // namespace hlk_ld2413
+} // namespace esphome
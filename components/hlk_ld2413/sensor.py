@@ -1,12 +1,18 @@
+from esphome import automation, pins # type: ignore
 import esphome.codegen as cg # type: ignore
 import esphome.config_validation as cv # type: ignore
-from esphome.components import sensor, uart # type: ignore
+from esphome.components import sensor, time, uart # type: ignore
 from esphome.const import ( # type: ignore
     CONF_ID,
+    CONF_TIME_ID,
     CONF_UPDATE_INTERVAL,
     DEVICE_CLASS_DISTANCE,
+    DEVICE_CLASS_DURATION,
+    ENTITY_CATEGORY_DIAGNOSTIC,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_MILLIMETER,
+    UNIT_MINUTE,
 )
 
 DEPENDENCIES = ['uart']
@@ -16,6 +22,49 @@ CONF_MIN_DISTANCE = "min_distance"
 CONF_MAX_DISTANCE = "max_distance"
 CONF_REPORT_CYCLE = "report_cycle"
 CONF_CALIBRATE_ON_BOOT = "calibrate_on_boot"
+CONF_RATE_WINDOW = "rate_window"
+CONF_ADAPTIVE_REPORT_CYCLE = "adaptive_report_cycle"
+CONF_FAST_REPORT_CYCLE = "fast_report_cycle"
+CONF_SLOW_REPORT_CYCLE = "slow_report_cycle"
+CONF_MOVING_THRESHOLD = "moving_threshold"
+CONF_STEADY_THRESHOLD = "steady_threshold"
+CONF_STEADY_TIME = "steady_time"
+CONF_FULL_DISTANCE = "full_distance"
+CONF_EMPTY_DISTANCE = "empty_distance"
+CONF_LEVEL_RATE = "level_rate"
+CONF_TIME_TO_FULL = "time_to_full"
+CONF_TIME_TO_EMPTY = "time_to_empty"
+CONF_FRAMES_RECEIVED = "frames_received"
+CONF_RESYNCS = "resyncs"
+CONF_BAD_FOOTERS = "bad_footers"
+CONF_LENGTH_MISMATCHES = "length_mismatches"
+CONF_OUT_OF_RANGE = "out_of_range"
+CONF_BYTES_DISCARDED = "bytes_discarded"
+CONF_FRAME_RATE = "frame_rate"
+CONF_TRACE_SIZE = "trace_size"
+CONF_CAPTURE_SIZE = "capture_size"
+CONF_POWER_PIN = "power_pin"
+CONF_FRAMES_PER_SAMPLE = "frames_per_sample"
+CONF_WARMUP_TIMEOUT = "warmup_timeout"
+CONF_CALIBRATION_INTERVAL = "calibration_interval"
+CONF_CALIBRATION_HOUR = "calibration_hour"
+CONF_PUBLISH_ON_CHANGE = "publish_on_change"
+CONF_THRESHOLD = "threshold"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+
+UNIT_MILLIMETER_PER_MINUTE = "mm/min"
+UNIT_FRAMES_PER_SECOND = "frames/s"
+
+# Frame accounting counters, all published as diagnostic sensors
+DIAGNOSTIC_COUNTERS = [
+    CONF_FRAMES_RECEIVED,
+    CONF_RESYNCS,
+    CONF_BAD_FOOTERS,
+    CONF_LENGTH_MISMATCHES,
+    CONF_OUT_OF_RANGE,
+    CONF_BYTES_DISCARDED,
+]
 
 # Validation constants from datasheet
 MIN_VALID_DISTANCE = 150  # mm
@@ -23,8 +72,16 @@ MAX_VALID_DISTANCE = 10500  # mm
 MIN_REPORT_CYCLE = 50  # ms
 MAX_REPORT_CYCLE = 1000  # ms
 
+# Without a time source the calibration age is measured with the 32-bit ms uptime
+MAX_UPTIME_CALIBRATION_INTERVAL = 45 * 24 * 3600  # s
+
 hlk_ld2413_ns = cg.esphome_ns.namespace('hlk_ld2413')
 HLKLD2413Sensor = hlk_ld2413_ns.class_('HLKLD2413Sensor', sensor.Sensor, cg.PollingComponent)
+DumpTraceAction = hlk_ld2413_ns.class_('DumpTraceAction', automation.Action)
+StartCaptureAction = hlk_ld2413_ns.class_('StartCaptureAction', automation.Action)
+StopCaptureAction = hlk_ld2413_ns.class_('StopCaptureAction', automation.Action)
+DumpCaptureAction = hlk_ld2413_ns.class_('DumpCaptureAction', automation.Action)
+CalibrateAction = hlk_ld2413_ns.class_('CalibrateAction', automation.Action)
 
 def validate_config(config):
     # Validate min_distance is less than max_distance
@@ -47,6 +104,47 @@ def validate_config(config):
     if report_cycle_ms > MAX_REPORT_CYCLE:
         raise cv.Invalid(f"report_cycle must be at most {MAX_REPORT_CYCLE}ms (got {report_cycle_ms}ms)")
     
+    # Validate the adaptive report cycle bounds and thresholds
+    if CONF_ADAPTIVE_REPORT_CYCLE in config:
+        adaptive = config[CONF_ADAPTIVE_REPORT_CYCLE]
+        fast_ms = int(adaptive[CONF_FAST_REPORT_CYCLE].total_milliseconds)
+        slow_ms = int(adaptive[CONF_SLOW_REPORT_CYCLE].total_milliseconds)
+        for name, value in ((CONF_FAST_REPORT_CYCLE, fast_ms), (CONF_SLOW_REPORT_CYCLE, slow_ms)):
+            if value < MIN_REPORT_CYCLE or value > MAX_REPORT_CYCLE:
+                raise cv.Invalid(f"{name} must be between {MIN_REPORT_CYCLE}ms and {MAX_REPORT_CYCLE}ms (got {value}ms)")
+        if fast_ms >= slow_ms:
+            raise cv.Invalid("fast_report_cycle must be shorter than slow_report_cycle")
+        if adaptive[CONF_STEADY_THRESHOLD] >= adaptive[CONF_MOVING_THRESHOLD]:
+            raise cv.Invalid("steady_threshold must be less than moving_threshold")
+    
+    # Switching report cycles needs the sensor to stay powered
+    if CONF_POWER_PIN in config and CONF_ADAPTIVE_REPORT_CYCLE in config:
+        raise cv.Invalid("adaptive_report_cycle can't be used together with power_pin")
+    
+    # Duty-cycle mode publishes one sample per update on its own
+    if CONF_POWER_PIN in config and CONF_PUBLISH_ON_CHANGE in config:
+        raise cv.Invalid("publish_on_change can't be used together with power_pin")
+    
+    if CONF_PUBLISH_ON_CHANGE in config:
+        on_change = config[CONF_PUBLISH_ON_CHANGE]
+        max_interval_ms = int(on_change[CONF_MAX_INTERVAL].total_milliseconds)
+        if 0 < max_interval_ms < int(on_change[CONF_MIN_INTERVAL].total_milliseconds):
+            raise cv.Invalid("max_interval must not be shorter than min_interval")
+    
+    # Scheduled calibration
+    if CONF_CALIBRATION_HOUR in config and CONF_TIME_ID not in config:
+        raise cv.Invalid("calibration_hour requires time_id")
+    if CONF_CALIBRATION_INTERVAL in config and CONF_TIME_ID not in config:
+        interval_s = int(config[CONF_CALIBRATION_INTERVAL].total_seconds)
+        if interval_s > MAX_UPTIME_CALIBRATION_INTERVAL:
+            raise cv.Invalid("calibration_interval longer than 45 days requires time_id")
+    
+    # Validate the tank end points used for the ETA sensors
+    full_distance = config.get(CONF_FULL_DISTANCE, config[CONF_MIN_DISTANCE])
+    empty_distance = config.get(CONF_EMPTY_DISTANCE, config[CONF_MAX_DISTANCE])
+    if full_distance >= empty_distance:
+        raise cv.Invalid("full_distance must be less than empty_distance")
+    
     return config
 
 # Create a modified UART schema that only requires baud_rate
@@ -64,6 +162,20 @@ modified_uart_schema = {
 # Create our custom UART schema
 UART_SCHEMA = cv.Schema(modified_uart_schema)
 
+ADAPTIVE_REPORT_CYCLE_SCHEMA = cv.Schema({
+    cv.Optional(CONF_FAST_REPORT_CYCLE, default=f"{MIN_REPORT_CYCLE}ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_SLOW_REPORT_CYCLE, default=f"{MAX_REPORT_CYCLE}ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_MOVING_THRESHOLD, default=30.0): cv.positive_float,  # mm/min
+    cv.Optional(CONF_STEADY_THRESHOLD, default=10.0): cv.positive_float,  # mm/min
+    cv.Optional(CONF_STEADY_TIME, default="60s"): cv.positive_time_period_milliseconds,
+})
+
+PUBLISH_ON_CHANGE_SCHEMA = cv.Schema({
+    cv.Optional(CONF_THRESHOLD, default="5mm"): cv.distance,
+    cv.Optional(CONF_MIN_INTERVAL, default="1s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_MAX_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+})
+
 CONFIG_SCHEMA = cv.All(
     sensor.sensor_schema(
         HLKLD2413Sensor,
@@ -78,10 +190,68 @@ CONFIG_SCHEMA = cv.All(
         cv.Optional(CONF_MAX_DISTANCE, default=f"{MAX_VALID_DISTANCE}mm"): cv.distance,
         cv.Optional(CONF_REPORT_CYCLE, default=f"160ms"): cv.positive_time_period_milliseconds,
         cv.Optional(CONF_CALIBRATE_ON_BOOT, default=False): cv.boolean,
+        cv.Optional(CONF_RATE_WINDOW, default="10s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_ADAPTIVE_REPORT_CYCLE): ADAPTIVE_REPORT_CYCLE_SCHEMA,
+        cv.Optional(CONF_PUBLISH_ON_CHANGE): PUBLISH_ON_CHANGE_SCHEMA,
+        cv.Optional(CONF_FULL_DISTANCE): cv.distance,
+        cv.Optional(CONF_EMPTY_DISTANCE): cv.distance,
+        cv.Optional(CONF_LEVEL_RATE): sensor.sensor_schema(
+            unit_of_measurement=UNIT_MILLIMETER_PER_MINUTE,
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+        ),
+        cv.Optional(CONF_TIME_TO_FULL): sensor.sensor_schema(
+            unit_of_measurement=UNIT_MINUTE,
+            accuracy_decimals=0,
+            device_class=DEVICE_CLASS_DURATION,
+            state_class=STATE_CLASS_MEASUREMENT,
+        ),
+        cv.Optional(CONF_TIME_TO_EMPTY): sensor.sensor_schema(
+            unit_of_measurement=UNIT_MINUTE,
+            accuracy_decimals=0,
+            device_class=DEVICE_CLASS_DURATION,
+            state_class=STATE_CLASS_MEASUREMENT,
+        ),
+        **{
+            cv.Optional(counter): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            )
+            for counter in DIAGNOSTIC_COUNTERS
+        },
+        cv.Optional(CONF_FRAME_RATE): sensor.sensor_schema(
+            unit_of_measurement=UNIT_FRAMES_PER_SECOND,
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_TRACE_SIZE, default=256): cv.int_range(0, 4096),
+        cv.Optional(CONF_CAPTURE_SIZE, default=8192): cv.int_range(0, 65536),
+        cv.Optional(CONF_POWER_PIN): pins.gpio_output_pin_schema,
+        cv.Optional(CONF_FRAMES_PER_SAMPLE, default=5): cv.int_range(1, 16),
+        cv.Optional(CONF_WARMUP_TIMEOUT, default="5s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_CALIBRATION_INTERVAL): cv.positive_time_period_seconds,
+        cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
+        cv.Optional(CONF_CALIBRATION_HOUR): cv.int_range(0, 23),
     }).extend(UART_SCHEMA),
     validate_config
 )
 
+HLK_LD2413_ACTION_SCHEMA = automation.maybe_simple_id({
+    cv.GenerateID(): cv.use_id(HLKLD2413Sensor),
+})
+
+@automation.register_action("hlk_ld2413.dump_trace", DumpTraceAction, HLK_LD2413_ACTION_SCHEMA)
+@automation.register_action("hlk_ld2413.start_capture", StartCaptureAction, HLK_LD2413_ACTION_SCHEMA)
+@automation.register_action("hlk_ld2413.stop_capture", StopCaptureAction, HLK_LD2413_ACTION_SCHEMA)
+@automation.register_action("hlk_ld2413.dump_capture", DumpCaptureAction, HLK_LD2413_ACTION_SCHEMA)
+@automation.register_action("hlk_ld2413.calibrate", CalibrateAction, HLK_LD2413_ACTION_SCHEMA)
+async def hlk_ld2413_action_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await sensor.register_sensor(var, config)
@@ -104,4 +274,65 @@ async def to_code(config):
         cg.add(var.set_report_cycle(report_cycle_ms))
         
     if CONF_CALIBRATE_ON_BOOT in config:
-        cg.add(var.set_calibrate_on_boot(config[CONF_CALIBRATE_ON_BOOT]))
\ No newline at end of file
+        cg.add(var.set_calibrate_on_boot(config[CONF_CALIBRATE_ON_BOOT]))
+        
+    cg.add(var.set_rate_window(int(config[CONF_RATE_WINDOW].total_milliseconds)))
+    
+    if CONF_ADAPTIVE_REPORT_CYCLE in config:
+        adaptive = config[CONF_ADAPTIVE_REPORT_CYCLE]
+        cg.add(var.set_adaptive_report_cycle(
+            int(adaptive[CONF_FAST_REPORT_CYCLE].total_milliseconds),
+            int(adaptive[CONF_SLOW_REPORT_CYCLE].total_milliseconds),
+            adaptive[CONF_MOVING_THRESHOLD],
+            adaptive[CONF_STEADY_THRESHOLD],
+            int(adaptive[CONF_STEADY_TIME].total_milliseconds),
+        ))
+    
+    if CONF_PUBLISH_ON_CHANGE in config:
+        on_change = config[CONF_PUBLISH_ON_CHANGE]
+        cg.add(var.set_publish_on_change(
+            on_change[CONF_THRESHOLD] * 1000,
+            int(on_change[CONF_MIN_INTERVAL].total_milliseconds),
+            int(on_change[CONF_MAX_INTERVAL].total_milliseconds),
+        ))
+    
+    if CONF_FULL_DISTANCE in config:
+        cg.add(var.set_full_distance(int(config[CONF_FULL_DISTANCE] * 1000)))
+        
+    if CONF_EMPTY_DISTANCE in config:
+        cg.add(var.set_empty_distance(int(config[CONF_EMPTY_DISTANCE] * 1000)))
+    
+    if CONF_LEVEL_RATE in config:
+        sens = await sensor.new_sensor(config[CONF_LEVEL_RATE])
+        cg.add(var.set_level_rate_sensor(sens))
+        
+    if CONF_TIME_TO_FULL in config:
+        sens = await sensor.new_sensor(config[CONF_TIME_TO_FULL])
+        cg.add(var.set_time_to_full_sensor(sens))
+        
+    if CONF_TIME_TO_EMPTY in config:
+        sens = await sensor.new_sensor(config[CONF_TIME_TO_EMPTY])
+        cg.add(var.set_time_to_empty_sensor(sens))
+        
+    for counter in DIAGNOSTIC_COUNTERS + [CONF_FRAME_RATE]:
+        if counter in config:
+            sens = await sensor.new_sensor(config[counter])
+            cg.add(getattr(var, f"set_{counter}_sensor")(sens))
+            
+    cg.add(var.set_trace_size(config[CONF_TRACE_SIZE]))
+    cg.add(var.set_capture_size(config[CONF_CAPTURE_SIZE]))
+    
+    if CONF_POWER_PIN in config:
+        power_pin = await cg.gpio_pin_expression(config[CONF_POWER_PIN])
+        cg.add(var.set_power_pin(power_pin))
+        cg.add(var.set_frames_per_sample(config[CONF_FRAMES_PER_SAMPLE]))
+        cg.add(var.set_warmup_timeout(int(config[CONF_WARMUP_TIMEOUT].total_milliseconds)))
+    
+    if CONF_CALIBRATION_INTERVAL in config:
+        cg.add(var.set_calibration_interval(int(config[CONF_CALIBRATION_INTERVAL].total_seconds)))
+        
+    if CONF_TIME_ID in config:
+        time_ = await cg.get_variable(config[CONF_TIME_ID])
+        cg.add(var.set_time(time_))
+        if CONF_CALIBRATION_HOUR in config:
+            cg.add(var.set_calibration_hour(config[CONF_CALIBRATION_HOUR]))
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    enum TraceEvent : uint8_t
+    {
+      TRACE_FRAME = 0,
+      TRACE_RESYNC,
+      TRACE_BAD_FOOTER,
+      TRACE_LENGTH_MISMATCH,
+      TRACE_OUT_OF_RANGE,
+      TRACE_BUFFER_LARGE,
+      TRACE_ACK,
+    };
+
+    static const char *const TRACE_EVENT_NAMES[] = {
+        "frame",
+        "resync",
+        "bad footer",
+        "length mismatch",
+        "out of range",
+        "buffer large",
+        "ack",
+    };
+
+    // Passive record of the last bytes received from the sensor and of what the
+    // parser made of them. Recording only copies bytes the parser has already
+    // read, so dumping it never changes what the parser sees.
+    class TraceRing
+    {
+    public:
+      static const size_t EVENT_COUNT = 32;
+
+      // Allocates the byte ring once; 0 disables byte recording
+      void set_size(size_t size)
+      {
+        this->size_ = size;
+        this->bytes_.reset(size > 0 ? new uint8_t[size] : nullptr);
+      }
+      size_t get_size() const { return this->size_; }
+
+      // Total bytes seen since boot, used as the offset of every byte and event
+      uint32_t get_total_bytes() const { return this->total_bytes_; }
+
+      void add_bytes(const uint8_t *data, size_t length)
+      {
+        for (size_t i = 0; i < length && this->size_ > 0; i++)
+        {
+          this->bytes_[(this->total_bytes_ + i) % this->size_] = data[i];
+        }
+        this->total_bytes_ += length;
+      }
+
+      // Records an event at a stream offset (see get_total_bytes())
+      void add_event(TraceEvent event, uint32_t offset)
+      {
+        Entry &entry = this->events_[this->event_count_ % EVENT_COUNT];
+        entry.time = millis();
+        entry.offset = offset;
+        entry.event = event;
+        this->event_count_++;
+      }
+
+      void dump(const char *tag) const
+      {
+        uint32_t kept = std::min<uint32_t>(this->total_bytes_, this->size_);
+        uint32_t first = this->total_bytes_ - kept;
+        ESP_LOGI(tag, "Trace: last %u of %u bytes received", (unsigned) kept, (unsigned) this->total_bytes_);
+
+        // Log the bytes in chunks of 16, prefixed with their stream offset
+        for (uint32_t offset = first; offset < this->total_bytes_; offset += 16)
+        {
+          char log_str[16 * 3 + 1] = {0};
+          char *ptr = log_str;
+          for (uint32_t i = offset; i < offset + 16 && i < this->total_bytes_; i++)
+          {
+            ptr += sprintf(ptr, "%02X ", this->bytes_[i % this->size_]);
+          }
+          ESP_LOGI(tag, "  @%u: %s", (unsigned) offset, log_str);
+        }
+
+        uint32_t events = std::min<uint32_t>(this->event_count_, EVENT_COUNT);
+        ESP_LOGI(tag, "Trace: last %u of %u parser events", (unsigned) events, (unsigned) this->event_count_);
+        for (uint32_t n = this->event_count_ - events; n < this->event_count_; n++)
+        {
+          const Entry &entry = this->events_[n % EVENT_COUNT];
+          ESP_LOGI(tag, "  %ums @%u: %s", (unsigned) entry.time, (unsigned) entry.offset, TRACE_EVENT_NAMES[entry.event]);
+        }
+      }
+
+    protected:
+      struct Entry
+      {
+        uint32_t time;
+        uint32_t offset;
+        TraceEvent event;
+      };
+
+      std::unique_ptr<uint8_t[]> bytes_;
+      size_t size_{0};
+      uint32_t total_bytes_{0};
+      Entry events_[EVENT_COUNT];
+      uint32_t event_count_{0};
+    };
+
+  } // namespace hlk_ld2413
+} // namespace esphome
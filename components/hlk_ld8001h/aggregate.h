@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		static const uint8_t MAX_BURST_SAMPLES = 15;
+
+		enum BurstAggregate : uint8_t
+		{
+			BURST_MEDIAN = 0,
+			BURST_TRIMMED_MEAN,
+		};
+
+		// Combine a burst of readings into one value. Sorts samples in place.
+		inline float aggregate_samples(uint16_t *samples, uint8_t count, BurstAggregate mode)
+		{
+			std::sort(samples, samples + count);
+
+			if (mode == BURST_TRIMMED_MEAN)
+			{
+				// Drop the lowest and highest quarter, ripple peaks and troughs
+				uint8_t trim = count / 4;
+				uint32_t sum = 0;
+				for (uint8_t i = trim; i < count - trim; i++)
+				{
+					sum += samples[i];
+				}
+				return (float)sum / (count - 2 * trim);
+			}
+
+			if (count % 2 == 1)
+				return samples[count / 2];
+			return (samples[count / 2 - 1] + samples[count / 2]) / 2.0f;
+		}
+
+		// Range of a sorted burst
+		inline float sample_spread(const uint16_t *samples, uint8_t count) { return samples[count - 1] - samples[0]; }
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esphome/core/automation.h"
+#include "hlk_ld8001h.h"
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		template <typename... Ts>
+		class DiscoverAction : public Action<Ts...>, public Parented<HLKLD8001HSensor>
+		{
+		public:
+			void play(Ts... x) override { this->parent_->discover(); }
+		};
+
+		// Fires with the new distance and the change, in mm, as soon as a reading
+		// moves by the change threshold
+		class LevelChangeTrigger : public Trigger<float, float>
+		{
+		public:
+			explicit LevelChangeTrigger(HLKLD8001HSensor *parent)
+			{
+				parent->add_on_level_change_callback([this](float distance, float delta)
+													 { this->trigger(distance, delta); });
+			}
+		};
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		// CRC16/MODBUS: reflected polynomial 0xA001, initial value 0xFFFF, sent low byte first.
+		//
+		// The lookup tables are generated at compile time from the bitwise
+		// algorithm, so they can't drift from it. The full table (512 bytes)
+		// handles a byte per lookup; define HLK_LD8001H_CRC_NIBBLE_TABLE in
+		// build_flags to use the 32 byte nibble table instead, at two lookups per byte.
+
+		static const uint16_t CRC16_MODBUS_POLY = 0xA001;
+		static const uint16_t CRC16_MODBUS_INIT = 0xFFFF;
+
+		// One step of the bitwise algorithm over the low bits of value
+		constexpr uint16_t crc16_modbus_bits(uint16_t value, uint8_t bits)
+		{
+			for (uint8_t i = 0; i < bits; i++)
+			{
+				value = (value & 0x0001) ? (value >> 1) ^ CRC16_MODBUS_POLY : value >> 1;
+			}
+			return value;
+		}
+
+		template <size_t N>
+		struct Crc16Table
+		{
+			uint16_t values[N];
+		};
+
+		template <size_t N>
+		constexpr Crc16Table<N> make_crc16_table(uint8_t bits)
+		{
+			Crc16Table<N> table{};
+			for (size_t i = 0; i < N; i++)
+			{
+				table.values[i] = crc16_modbus_bits(i, bits);
+			}
+			return table;
+		}
+
+		static constexpr Crc16Table<256> CRC16_MODBUS_TABLE = make_crc16_table<256>(8);
+		static constexpr Crc16Table<16> CRC16_MODBUS_NIBBLE_TABLE = make_crc16_table<16>(4);
+
+		static_assert(CRC16_MODBUS_TABLE.values[1] == 0xC0C1, "CRC16/MODBUS table generation");
+		static_assert(CRC16_MODBUS_NIBBLE_TABLE.values[1] == 0xCC01, "CRC16/MODBUS nibble table generation");
+
+		inline uint16_t crc16_modbus_table(const uint8_t *data, size_t length, uint16_t crc = CRC16_MODBUS_INIT)
+		{
+			for (size_t i = 0; i < length; i++)
+			{
+				crc = (crc >> 8) ^ CRC16_MODBUS_TABLE.values[(crc ^ data[i]) & 0xFF];
+			}
+			return crc;
+		}
+
+		inline uint16_t crc16_modbus_nibble(const uint8_t *data, size_t length, uint16_t crc = CRC16_MODBUS_INIT)
+		{
+			for (size_t i = 0; i < length; i++)
+			{
+				crc ^= data[i];
+				crc = (crc >> 4) ^ CRC16_MODBUS_NIBBLE_TABLE.values[crc & 0x0F];
+				crc = (crc >> 4) ^ CRC16_MODBUS_NIBBLE_TABLE.values[crc & 0x0F];
+			}
+			return crc;
+		}
+
+		inline uint16_t crc16_modbus(const uint8_t *data, size_t length, uint16_t crc = CRC16_MODBUS_INIT)
+		{
+#ifdef HLK_LD8001H_CRC_NIBBLE_TABLE
+			return crc16_modbus_nibble(data, length, crc);
+#else
+			return crc16_modbus_table(data, length, crc);
+#endif
+		}
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
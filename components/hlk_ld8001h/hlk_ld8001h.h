@@ -1,9 +1,15 @@
 #pragma once
 
+#include <cmath>
 #include "esphome/core/component.h"
 #include "esphome/components/sensor/sensor.h"
-#include "esphome/components/uart/uart.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "aggregate.h"
+#include "modbus_bus.h"
+#include "registers.h"
+#include "tank.h"
 
 namespace esphome
 {
@@ -12,24 +18,87 @@ namespace esphome
 
 		static const char *const TAG = "hlk_ld8001h";
 
-		// MODBUS register addresses
-		static const uint16_t REG_SPACE_HEIGHT = 0x0001;		// R/- Space height (mm)
-		static const uint16_t REG_WATER_LEVEL = 0x0003;			// R/- Water level (mm)
-		static const uint16_t REG_INSTALLATION_HEIGHT = 0x0005; // R/W Installation height (cm)
-		static const uint16_t REG_DEVICE_ADDRESS = 0x03F4;		// R/W Device address
-		static const uint16_t REG_BAUD_RATE = 0x03F6;			// R/W Baud rate
-		static const uint16_t REG_RANGE = 0x07D4;				// R/W Range (m)
+		// Space height and water level are read together as one block
+		using MeasurementBlock = RegisterBlock<SpaceHeightRegister, WaterLevelRegister>;
+		static_assert(MeasurementBlock::START == SpaceHeightRegister::ADDRESS, "Single reads start at the space height too");
 
-		class HLKLD8001HSensor : public sensor::Sensor, public PollingComponent, public uart::UARTDevice
+		static const uint32_t ADDRESS_PREF_KEY = 0x41445231;
+		static const uint32_t CONFIG_PREF_KEY = 0x43464731;
+		// A configuration known to be on the sensor is checked again this long after boot
+		static const uint32_t CONFIG_REVALIDATE_DELAY = 60000; // ms
+
+		// Address found by discovery, only used while modbus_address in the YAML is unchanged
+		struct DiscoveredAddress
+		{
+			uint8_t configured;
+			uint8_t discovered;
+		};
+
+		// Settings last verified on the sensor, and the address they were verified at
+		struct ConfigShadow
+		{
+			uint8_t address;
+			uint8_t has_installation_height;
+			uint16_t installation_height;
+			uint16_t range;
+
+			bool operator==(const ConfigShadow &other) const
+			{
+				return this->address == other.address && this->has_installation_height == other.has_installation_height &&
+					   this->installation_height == other.installation_height && this->range == other.range;
+			}
+			bool operator!=(const ConfigShadow &other) const { return !(*this == other); }
+		};
+
+		class HLKLD8001HSensor : public sensor::Sensor, public PollingComponent, public ModbusBusClient
 		{
 		public:
 			HLKLD8001HSensor() : PollingComponent(2000) {}
 
-			void set_installation_height(uint16_t installation_height) { this->installation_height_ = installation_height; }
-			void set_range(uint16_t range) { this->range_ = range; }
-			void set_modbus_address(uint8_t modbus_address) { this->modbus_address_ = modbus_address; }
+			void set_bus(ModbusBus *bus) { this->bus_ = bus; }
+
+			// Distances in mm, stored in the units of their registers
+			void set_installation_height(uint32_t installation_height)
+			{
+				this->installation_height_ = InstallationHeightRegister::to_raw(installation_height);
+			}
+			void set_range(uint32_t range) { this->range_ = RangeRegister::to_raw(range); }
+			void set_modbus_address(uint8_t modbus_address)
+			{
+				this->modbus_address_ = modbus_address;
+				this->configured_address_ = modbus_address;
+			}
 			void set_water_depth_sensor(sensor::Sensor *water_depth_sensor) { this->water_depth_sensor_ = water_depth_sensor; }
 			void set_has_installation_height(bool has_installation_height) { this->has_installation_height_ = has_installation_height; }
+			void set_burst(uint8_t samples, BurstAggregate aggregate)
+			{
+				this->burst_samples_ = samples;
+				this->burst_aggregate_ = aggregate;
+			}
+			void set_spread_sensor(sensor::Sensor *spread_sensor) { this->spread_sensor_ = spread_sensor; }
+			void set_valid_samples_sensor(sensor::Sensor *valid_samples_sensor) { this->valid_samples_sensor_ = valid_samples_sensor; }
+			void set_link_quality_sensor(sensor::Sensor *link_quality_sensor) { this->link_quality_sensor_ = link_quality_sensor; }
+			void set_link_errors_sensor(sensor::Sensor *link_errors_sensor) { this->link_errors_sensor_ = link_errors_sensor; }
+			void set_link_timeouts_sensor(sensor::Sensor *link_timeouts_sensor) { this->link_timeouts_sensor_ = link_timeouts_sensor; }
+			void set_tank_table(const TankPoint *table, size_t size)
+			{
+				this->tank_table_ = table;
+				this->tank_table_size_ = size;
+			}
+			void set_change_threshold(float change_threshold) { this->change_threshold_ = change_threshold; }
+			// Poll at min_interval while the level moves, backing off to max_interval while it doesn't
+			void set_adaptive_polling(uint32_t min_interval, uint32_t max_interval)
+			{
+				this->min_interval_ = min_interval;
+				this->max_interval_ = max_interval;
+			}
+			// Called with the new distance and how far it moved since the last change, both in mm
+			void add_on_level_change_callback(std::function<void(float, float)> &&callback)
+			{
+				this->level_change_callback_.add(std::move(callback));
+			}
+			void set_volume_sensor(sensor::Sensor *volume_sensor) { this->volume_sensor_ = volume_sensor; }
+			void set_percent_sensor(sensor::Sensor *percent_sensor) { this->percent_sensor_ = percent_sensor; }
 
 			void setup() override
 			{
@@ -38,18 +107,30 @@ namespace esphome
 				// Initialize variables
 				this->last_successful_read_ = 0;
 				this->setup_complete_ = false;
-				this->last_modbus_operation_ = 0;
 
-				// Configure the sensor
-				if (configure_sensor())
+				this->address_pref_ = global_preferences->make_preference<DiscoveredAddress>(this->get_object_id_hash() ^ ADDRESS_PREF_KEY);
+				DiscoveredAddress cached;
+				if (this->address_pref_.load(&cached) && cached.configured == this->configured_address_ &&
+					cached.discovered != this->configured_address_)
 				{
-					ESP_LOGI(TAG, "HLK-LD8001H setup complete");
-					this->setup_complete_ = true;
+					ESP_LOGI(TAG, "Using discovered address 0x%02X instead of 0x%02X", cached.discovered, this->configured_address_);
+					this->modbus_address_ = cached.discovered;
 				}
-				else
+
+				// Settings the sensor already had at the last boot don't hold up the
+				// first reading, they're checked once the node has been up a while.
+				// Nodes that sleep sooner skip the check.
+				this->config_pref_ = global_preferences->make_preference<ConfigShadow>(this->get_object_id_hash() ^ CONFIG_PREF_KEY);
+				if (this->config_pref_.load(&this->config_shadow_) && this->config_shadow_ == wanted_config())
 				{
-					ESP_LOGW(TAG, "HLK-LD8001H setup incomplete - will retry during updates");
+					ESP_LOGI(TAG, "Configuration verified before, checking it again in %us", (unsigned)(CONFIG_REVALIDATE_DELAY / 1000));
+					this->setup_complete_ = true;
+					this->revalidate_pending_ = true;
+					return;
 				}
+
+				// Configure the sensor once the bus gives us a turn
+				request_bus_work(this->config_pending_);
 			}
 
 			void dump_config() override
@@ -69,66 +150,107 @@ namespace esphome
 					ESP_LOGCONFIG(TAG, "  Installation Height: Not set");
 				}
 				ESP_LOGCONFIG(TAG, "  Range: %dm", this->range_);
+				if (this->burst_samples_ > 1)
+				{
+					ESP_LOGCONFIG(TAG, "  Burst: %d samples, %s", this->burst_samples_,
+								  this->burst_aggregate_ == BURST_MEDIAN ? "median" : "trimmed mean");
+					LOG_SENSOR("    ", "Spread", this->spread_sensor_);
+					LOG_SENSOR("    ", "Valid Samples", this->valid_samples_sensor_);
+				}
+				if (this->tank_table_ != nullptr)
+				{
+					ESP_LOGCONFIG(TAG, "  Tank: %.0f l full at %u mm (%u table points)", this->tank_table_[this->tank_table_size_ - 1].volume,
+								  this->tank_table_[this->tank_table_size_ - 1].level, (unsigned)this->tank_table_size_);
+					LOG_SENSOR("    ", "Volume", this->volume_sensor_);
+					LOG_SENSOR("    ", "Percent Full", this->percent_sensor_);
+				}
+				LOG_SENSOR("  ", "Link Quality", this->link_quality_sensor_);
+				LOG_SENSOR("  ", "Link Errors", this->link_errors_sensor_);
+				LOG_SENSOR("  ", "Link Timeouts", this->link_timeouts_sensor_);
 				ESP_LOGCONFIG(TAG, "  Modbus Address: 0x%02X", this->modbus_address_);
+				if (this->modbus_address_ != this->configured_address_)
+				{
+					ESP_LOGCONFIG(TAG, "    Discovered, configured address is 0x%02X", this->configured_address_);
+				}
 				LOG_UPDATE_INTERVAL(this);
-				check_uart_settings(115200);
+				ESP_LOGCONFIG(TAG, "  Change Threshold: %.1fmm", this->change_threshold_);
+				if (this->max_interval_ != 0)
+				{
+					ESP_LOGCONFIG(TAG, "  Adaptive Polling: %ums to %ums", (unsigned)this->min_interval_, (unsigned)this->max_interval_);
+				}
 			}
 
 			void update() override
 			{
+				publish_link_stats();
+
 				// If setup wasn't completed, try again
 				if (!this->setup_complete_)
 				{
-					ESP_LOGI(TAG, "Retrying setup...");
-					if (configure_sensor())
+					if (this->config_pending_ || this->config_outstanding_ > 0)
 					{
-						ESP_LOGI(TAG, "HLK-LD8001H setup complete");
-						this->setup_complete_ = true;
-					}
-					else
-					{
-						ESP_LOGW(TAG, "HLK-LD8001H setup still incomplete - will retry next update");
+						ESP_LOGD(TAG, "Configuration still in progress");
 						return;
 					}
+					ESP_LOGI(TAG, "Retrying setup...");
+					request_bus_work(this->config_pending_);
+					return;
 				}
 
-				// Read empty height (distance to water)
-				float empty_height = read_space_height();
-
-				if (empty_height >= 0)
+				if (this->revalidate_pending_ && millis() >= CONFIG_REVALIDATE_DELAY)
 				{
-					// Valid reading for empty height
-					publish_state(empty_height);
-					this->last_successful_read_ = millis();
-					ESP_LOGD(TAG, "Published empty height: %.1f mm", empty_height);
+					ESP_LOGD(TAG, "Checking configuration");
+					this->revalidate_pending_ = false;
+					request_bus_work(this->config_pending_);
+				}
 
-					// Read water level if a sensor is attached and installation height is set
-					if (this->water_depth_sensor_ != nullptr && this->has_installation_height_)
+				if (this->poll_pending_ || this->reading_)
+				{
+					// An isolated sensor waits for its backoff, that's already been logged by the bus
+					if (!is_isolated())
 					{
-						float water_level = read_water_level();
-
-						if (water_level >= 0)
-						{
-							this->water_depth_sensor_->publish_state(water_level);
-							ESP_LOGD(TAG, "Published water level: %.1f mm", water_level);
-						}
-						else
-						{
-							ESP_LOGW(TAG, "Failed to read water level from device");
-						}
+						ESP_LOGW(TAG, "Previous reading still in progress, skipping this update");
 					}
+					return;
 				}
-				else
+
+				request_bus_work(this->poll_pending_);
+			}
+
+			uint8_t get_modbus_address() const override { return this->modbus_address_; }
+			bool has_bus_work() const override { return this->config_pending_ || this->poll_pending_; }
+			uint32_t bus_work_since() const override { return this->work_since_; }
+
+			// Look for the sensor at every address and baud rate, for when it doesn't answer as configured
+			void discover() { this->bus_->discover(this); }
+
+			void on_discovered(uint8_t address) override
+			{
+				if (address != this->configured_address_)
 				{
-					// Check if we haven't had a successful reading in a while
-					if (millis() - this->last_successful_read_ > 30000)
-					{
-						ESP_LOGW(TAG, "No valid readings for over 30 seconds!");
+					ESP_LOGW(TAG, "Sensor answers at address 0x%02X, not 0x%02X. Using it until modbus_address is changed",
+							 address, this->configured_address_);
+				}
+				this->modbus_address_ = address;
+				DiscoveredAddress cached{this->configured_address_, address};
+				this->address_pref_.save(&cached);
 
-						// Try to reconfigure if no readings
-						ESP_LOGI(TAG, "Attempting to reconfigure sensor...");
-						configure_sensor();
-					}
+				// Start over with the sensor we now know how to reach
+				this->setup_complete_ = false;
+				request_bus_work(this->config_pending_);
+			}
+
+			void run_bus_turn() override
+			{
+				if (this->config_pending_)
+				{
+					this->config_pending_ = false;
+					configure_sensor();
+				}
+				else if (this->poll_pending_)
+				{
+					this->poll_pending_ = false;
+					request_measurement();
 				}
 			}
 
@@ -136,359 +258,438 @@ namespace esphome
 			uint16_t installation_height_{200}; // Default 2m (200cm)
 			uint16_t range_{10};				// Default 10m
 			uint8_t modbus_address_{0x01};		// Default address 1
+			uint8_t configured_address_{0x01};	// modbus_address_ unless discovery found another
+			ESPPreferenceObject address_pref_;
+			ESPPreferenceObject config_pref_;
+			ConfigShadow config_shadow_{};
+			bool revalidate_pending_{false};
 			uint32_t last_successful_read_{0};
-			uint32_t last_modbus_operation_{0};
 			bool setup_complete_{false};
 			bool has_installation_height_{false};
+			bool block_reads_{true}; // Cleared if the sensor rejects reading the measurement block
+			bool reading_{false};	 // A measurement is queued or in progress
 			sensor::Sensor *water_depth_sensor_{nullptr};
-
-			// Calculate CRC16 (MODBUS)
-			uint16_t calculate_crc(uint8_t *buffer, uint8_t length)
+			sensor::Sensor *link_quality_sensor_{nullptr};
+			sensor::Sensor *link_errors_sensor_{nullptr};
+			sensor::Sensor *link_timeouts_sensor_{nullptr};
+			ModbusBus *bus_{nullptr};
+
+			// Level change detection and adaptive polling, disabled while max_interval_ is 0
+			float change_threshold_{10.0f}; // mm
+			uint32_t min_interval_{0};
+			uint32_t max_interval_{0};
+			float level_reference_{NAN}; // Distance at the last change
+			CallbackManager<void(float, float)> level_change_callback_;
+
+			// Tank volume, from the water level through the table sensor.py generated
+			const TankPoint *tank_table_{nullptr};
+			size_t tank_table_size_{0};
+			sensor::Sensor *volume_sensor_{nullptr};
+			sensor::Sensor *percent_sensor_{nullptr};
+
+			// Burst oversampling, a single sample per update unless configured
+			uint8_t burst_samples_{1};
+			BurstAggregate burst_aggregate_{BURST_MEDIAN};
+			sensor::Sensor *spread_sensor_{nullptr};
+			sensor::Sensor *valid_samples_sensor_{nullptr};
+			uint8_t samples_taken_{0};
+			uint8_t valid_samples_{0};
+			uint8_t water_samples_{0};
+			uint16_t space_height_samples_[MAX_BURST_SAMPLES];
+			uint16_t water_level_samples_[MAX_BURST_SAMPLES];
+
+			// Work waiting for our turn on the bus
+			bool config_pending_{false};
+			bool poll_pending_{false};
+			uint32_t work_since_{0};
+
+			// Configuration in progress
+			uint8_t config_outstanding_{0}; // Configuration requests not answered yet
+			bool config_success_{true};
+
+			void request_bus_work(bool &pending)
 			{
-				uint16_t crc = 0xFFFF;
-
-				for (uint8_t i = 0; i < length; i++)
+				if (!this->has_bus_work())
 				{
-					crc ^= (uint16_t)buffer[i];
-
-					for (uint8_t j = 0; j < 8; j++)
-					{
-						if (crc & 0x0001)
-						{
-							crc >>= 1;
-							crc ^= 0xA001;
-						}
-						else
-						{
-							crc >>= 1;
-						}
-					}
+					this->work_since_ = millis();
 				}
+				pending = true;
+			}
 
-				return crc;
+			// Share of the last transaction attempts the sensor answered, and the
+			// attempts that went wrong since boot
+			void publish_link_stats()
+			{
+				const ModbusStats &stats = get_link_stats();
+				float quality = stats.link_quality();
+				if (this->link_quality_sensor_ != nullptr && !std::isnan(quality))
+				{
+					this->link_quality_sensor_->publish_state(quality);
+				}
+				if (this->link_errors_sensor_ != nullptr)
+				{
+					this->link_errors_sensor_->publish_state(stats.errors());
+				}
+				if (this->link_timeouts_sensor_ != nullptr)
+				{
+					this->link_timeouts_sensor_->publish_state(stats.timeouts());
+				}
 			}
 
-			// Send MODBUS read request and get response
-			bool modbus_read_register(uint16_t reg_address, uint16_t &value, int max_attempts = 3)
+			bool with_water_level() const
 			{
-				uint8_t request[8];
-				uint8_t response[7];
+				return (this->water_depth_sensor_ != nullptr || this->tank_table_ != nullptr) && this->has_installation_height_;
+			}
 
-				// Ensure we don't perform operations too quickly
-				uint32_t now = millis();
-				uint32_t elapsed = now - this->last_modbus_operation_;
-				if (elapsed < 30)
+			// Take the samples for one update back to back; the bus sends each read
+			// as soon as the previous one is answered.
+			void request_measurement()
+			{
+				this->samples_taken_ = 0;
+				this->valid_samples_ = 0;
+				this->water_samples_ = 0;
+				if (!request_sample())
 				{
-					// Add a small delay to prevent operations from taking too long
-					delay(30 - elapsed);
+					ESP_LOGW(TAG, "Bus queue full, skipping this update");
 				}
+			}
 
-				// Retry up to max_attempts times
-				for (int attempt = 0; attempt < max_attempts; attempt++)
-				{
-					// Clear any data in the buffer
-					while (available())
-					{
-						read();
-					}
+			// Read the space height, and the water level if a sensor is attached and
+			// installation height is set. Both come from one transaction so they
+			// always belong to the same measurement. False if the bus queue is full.
+			bool request_sample()
+			{
+				uint8_t count = with_water_level() && this->block_reads_ ? MeasurementBlock::COUNT : 1;
 
-					// Prepare read request
-					request[0] = this->modbus_address_; // Modbus address
-					request[1] = 0x03;					// Function code (read holding register)
-					request[2] = reg_address >> 8;		// Register address high byte
-					request[3] = reg_address & 0xFF;	// Register address low byte
-					request[4] = 0x00;					// Number of registers high byte
-					request[5] = 0x01;					// Number of registers low byte
-
-					// Calculate CRC
-					uint16_t crc = calculate_crc(request, 6);
-					request[6] = crc & 0xFF; // CRC low byte
-					request[7] = crc >> 8;	 // CRC high byte
-
-					// Send request
-					ESP_LOGV(TAG, "Sending MODBUS read request for register 0x%04X (attempt %d)", reg_address, attempt + 1);
-					write_array(request, 8);
-
-					// Record the time of this operation
-					this->last_modbus_operation_ = millis();
-
-					// Wait for response with shorter timeouts
-					uint32_t start_time = millis();
-					uint8_t bytes_available = 0;
-					while ((bytes_available = available()) < 7 && (millis() - start_time < 100))
-					{
-						// Use shorter delays
-						delay(5);
-					}
+				this->reading_ = this->bus_->read_registers(this, SpaceHeightRegister::ADDRESS, count,
+															[this](const ModbusResponse &response)
+															{ handle_sample(response); });
+				return this->reading_;
+			}
 
-					// Check if we got a response
-					if (bytes_available >= 7)
-					{
-						if (read_array(response, 7))
-						{
-							// Verify response
-							if (response[0] == this->modbus_address_ && response[1] == 0x03 && response[2] == 0x02)
-							{
-								// Extract value
-								value = (response[3] << 8) | response[4];
-
-								// Verify CRC
-								uint16_t expected_crc = (response[6] << 8) | response[5];
-								uint16_t calculated_crc = calculate_crc(response, 5);
-
-								if (expected_crc == calculated_crc)
-								{
-									ESP_LOGV(TAG, "Successfully read register 0x%04X: %d", reg_address, value);
-									return true;
-								}
-								else
-								{
-									ESP_LOGW(TAG, "CRC error reading register 0x%04X", reg_address);
-								}
-							}
-							else
-							{
-								ESP_LOGW(TAG, "Invalid response format");
-							}
-						}
-						else
-						{
-							ESP_LOGW(TAG, "Failed to read response");
-						}
-					}
-					else
+			void handle_sample(const ModbusResponse &response)
+			{
+				// Firmware that refuses the gap register gets separate reads from now on
+				if (response.result == MODBUS_EXCEPTION && response.count > 1 &&
+					(response.exception_code == MODBUS_ILLEGAL_DATA_ADDRESS || response.exception_code == MODBUS_ILLEGAL_DATA_VALUE))
+				{
+					ESP_LOGW(TAG, "Sensor doesn't support block reads, reading registers separately");
+					this->block_reads_ = false;
+					request_measurement();
+					return;
+				}
+
+				this->samples_taken_++;
+				uint16_t space_height = response.values[MeasurementBlock::index_of<SpaceHeightRegister>()];
+				if (response.result == MODBUS_OK && check_reading<SpaceHeightRegister>(space_height))
+				{
+					this->space_height_samples_[this->valid_samples_++] = space_height;
+					uint16_t water_level = response.values[MeasurementBlock::index_of<WaterLevelRegister>()];
+					if (response.count == MeasurementBlock::COUNT && check_reading<WaterLevelRegister>(water_level))
 					{
-						ESP_LOGW(TAG, "No response or incomplete response");
+						this->water_level_samples_[this->water_samples_++] = water_level;
 					}
-
-					// Shorter delay before retrying
-					delay(30);
 				}
 
-				ESP_LOGW(TAG, "Failed to read register 0x%04X after %d attempts", reg_address, max_attempts);
-				return false;
+				if (this->samples_taken_ < this->burst_samples_)
+				{
+					if (request_sample())
+						return;
+					// Publish what the burst has so far rather than nothing
+					ESP_LOGW(TAG, "Bus queue full, ending the burst after %d of %d samples", this->samples_taken_,
+							 this->burst_samples_);
+				}
+				finish_measurement();
 			}
 
-			// Send MODBUS write request and verify
-			bool modbus_write_register(uint16_t reg_address, uint16_t value, int max_attempts = 3)
+			void finish_measurement()
 			{
-				uint8_t request[8];
-				uint8_t response[8];
-
-				// Ensure we don't perform operations too quickly
-				uint32_t now = millis();
-				uint32_t elapsed = now - this->last_modbus_operation_;
-				if (elapsed < 30)
+				if (this->valid_samples_sensor_ != nullptr)
 				{
-					// Add a small delay to prevent operations from taking too long
-					delay(30 - elapsed);
+					this->valid_samples_sensor_->publish_state(this->valid_samples_);
 				}
-
-				// Retry up to max_attempts times
-				for (int attempt = 0; attempt < max_attempts; attempt++)
+				if (this->valid_samples_ == 0)
 				{
-					// Clear any data in the buffer
-					while (available())
-					{
-						read();
-					}
+					this->reading_ = false;
+					handle_read_failure();
+					return;
+				}
 
-					// Prepare write request
-					request[0] = this->modbus_address_; // Modbus address
-					request[1] = 0x06;					// Function code (write single register)
-					request[2] = reg_address >> 8;		// Register address high byte
-					request[3] = reg_address & 0xFF;	// Register address low byte
-					request[4] = value >> 8;			// Value high byte
-					request[5] = value & 0xFF;			// Value low byte
-
-					// Calculate CRC
-					uint16_t crc = calculate_crc(request, 6);
-					request[6] = crc & 0xFF; // CRC low byte
-					request[7] = crc >> 8;	 // CRC high byte
-
-					// Send request
-					ESP_LOGV(TAG, "Sending MODBUS write request for register 0x%04X, value %d (attempt %d)",
-							 reg_address, value, attempt + 1);
-					write_array(request, 8);
-
-					// Record the time of this operation
-					this->last_modbus_operation_ = millis();
-
-					// Wait for response with shorter timeouts
-					uint32_t start_time = millis();
-					uint8_t bytes_available = 0;
-					while ((bytes_available = available()) < 8 && (millis() - start_time < 100))
+				// Valid reading for empty height
+				float empty_height = aggregate_samples(this->space_height_samples_, this->valid_samples_, this->burst_aggregate_); // Value in mm
+				publish_state(empty_height);
+				this->last_successful_read_ = millis();
+				if (this->burst_samples_ > 1)
+				{
+					float spread = sample_spread(this->space_height_samples_, this->valid_samples_);
+					ESP_LOGD(TAG, "Published empty height: %.1f mm (%d of %d samples, spread %.0f mm)", empty_height,
+							 this->valid_samples_, this->burst_samples_, spread);
+					if (this->spread_sensor_ != nullptr)
 					{
-						// Use shorter delays
-						delay(5);
+						this->spread_sensor_->publish_state(spread);
 					}
+				}
+				else
+				{
+					ESP_LOGD(TAG, "Published empty height: %.1f mm", empty_height);
+				}
 
-					// Check if we got a response
-					if (bytes_available >= 8)
-					{
-						if (read_array(response, 8))
-						{
-							// Verify response (should echo back the request)
-							if (response[0] == this->modbus_address_ && response[1] == 0x06 &&
-								response[2] == request[2] && response[3] == request[3] &&
-								response[4] == request[4] && response[5] == request[5])
-							{
-
-								// Verify CRC
-								uint16_t expected_crc = (response[7] << 8) | response[6];
-								uint16_t calculated_crc = calculate_crc(response, 6);
-
-								if (expected_crc == calculated_crc)
-								{
-									ESP_LOGV(TAG, "Successfully wrote register 0x%04X: %d", reg_address, value);
-
-									// Skip verification read to avoid long operations
-									return true;
-								}
-								else
-								{
-									ESP_LOGW(TAG, "CRC error in write response");
-								}
-							}
-							else
-							{
-								ESP_LOGW(TAG, "Invalid write response format");
-							}
-						}
-						else
-						{
-							ESP_LOGW(TAG, "Failed to read write response");
-						}
-					}
-					else
-					{
-						ESP_LOGW(TAG, "No response or incomplete response to write");
-					}
+				track_level(empty_height);
 
-					// Shorter delay before retrying
-					delay(30);
+				if (!with_water_level())
+				{
+					this->reading_ = false;
+				}
+				else if (this->water_samples_ > 0)
+				{
+					publish_water_level(aggregate_samples(this->water_level_samples_, this->water_samples_, this->burst_aggregate_));
+					this->reading_ = false;
+				}
+				else
+				{
+					// The sensor filters the water level itself, one read is enough
+					this->reading_ = this->bus_->read_registers(this, WaterLevelRegister::ADDRESS, 1,
+																[this](const ModbusResponse &response)
+																{
+																	this->reading_ = false;
+																	if (response.result == MODBUS_OK)
+																	{
+																		if (check_reading<WaterLevelRegister>(response.values[0]))
+																			publish_water_level(response.values[0]);
+																	}
+																	else
+																	{
+																		ESP_LOGW(TAG, "Failed to read water level from device");
+																	}
+																});
 				}
+			}
 
-				ESP_LOGW(TAG, "Failed to write register 0x%04X after %d attempts", reg_address, max_attempts);
+			// A reading outside its register's range is garbage, not a measurement
+			template <typename Register>
+			bool check_reading(uint16_t raw)
+			{
+				if (Register::is_valid(raw))
+					return true;
+				ESP_LOGW(TAG, "Ignoring %s of %u %s, valid range is %u to %u", Register::NAME, raw, Register::UNIT, Register::MIN,
+						 Register::MAX);
 				return false;
 			}
 
-			// Read space height
-			float read_space_height()
+			// Compare with the distance at the last change rather than the last
+			// reading, so a slow drift adds up until it counts as a change too
+			void track_level(float distance)
 			{
-				uint16_t raw_space_height;
-
-				if (modbus_read_register(REG_SPACE_HEIGHT, raw_space_height))
+				if (std::isnan(this->level_reference_))
 				{
-					return raw_space_height; // Value in mm
+					this->level_reference_ = distance;
+					return;
 				}
-				else
+
+				float delta = distance - this->level_reference_;
+				if (std::fabs(delta) >= this->change_threshold_)
 				{
-					return -1; // Error
+					ESP_LOGD(TAG, "Level changed, distance moved %.1f mm", delta);
+					this->level_reference_ = distance;
+					set_poll_interval(this->min_interval_);
+					this->level_change_callback_.call(distance, delta);
+					return;
 				}
+
+				// Static: back off exponentially
+				uint32_t interval = get_update_interval() * 2;
+				set_poll_interval(interval < this->max_interval_ ? interval : this->max_interval_);
 			}
 
-			// Read water level
-			float read_water_level()
+			void set_poll_interval(uint32_t interval)
 			{
-				uint16_t raw_water_level;
+				if (this->max_interval_ == 0 || interval == get_update_interval())
+					return;
+				ESP_LOGD(TAG, "Polling every %ums", (unsigned)interval);
+				bool sooner = interval < get_update_interval();
+				set_update_interval(interval);
+				stop_poller();
+				start_poller();
+				// The restarted poller first runs after a random offset of up to half
+				// the interval, so follow a change up on the next bus turn instead.
+				// The bus only gives turns once this reading's requests are done.
+				if (sooner && !this->poll_pending_)
+				{
+					request_bus_work(this->poll_pending_);
+				}
+			}
 
-				if (modbus_read_register(REG_WATER_LEVEL, raw_water_level))
+			void publish_water_level(float water_level)
+			{
+				if (this->water_depth_sensor_ != nullptr)
 				{
-					return raw_water_level; // Value in mm
+					this->water_depth_sensor_->publish_state(water_level);
+					ESP_LOGD(TAG, "Published water level: %.1f mm", water_level);
 				}
-				else
+				if (this->tank_table_ == nullptr)
+					return;
+
+				// One table lookup, the geometry was worked out at compile time
+				float volume = tank_volume(this->tank_table_, this->tank_table_size_, water_level);
+				float full = this->tank_table_[this->tank_table_size_ - 1].volume;
+				ESP_LOGD(TAG, "Tank volume: %.1f l", volume);
+				if (this->volume_sensor_ != nullptr)
 				{
-					return -1; // Error
+					this->volume_sensor_->publish_state(volume);
+				}
+				if (this->percent_sensor_ != nullptr)
+				{
+					this->percent_sensor_->publish_state(100.0f * volume / full);
 				}
 			}
 
-			// Configure the sensor
-			bool configure_sensor()
+			void handle_read_failure()
+			{
+				// Check if we haven't had a successful reading in a while
+				if (millis() - this->last_successful_read_ > 30000 && !this->config_pending_ && this->config_outstanding_ == 0)
+				{
+					ESP_LOGW(TAG, "No valid readings for over 30 seconds!");
+
+					// Try to reconfigure if no readings
+					ESP_LOGI(TAG, "Attempting to reconfigure sensor...");
+					this->setup_complete_ = false;
+					request_bus_work(this->config_pending_);
+				}
+			}
+
+			// Configure the sensor. Each setting is read back first and only written
+			// if it differs; the sequence completes in finish_configuration().
+			void configure_sensor()
 			{
 				ESP_LOGI(TAG, "Configuring HLK-LD8001H sensor...");
-				bool success = true;
-				delay(30); // Short delay to ensure the sensor is ready
+				this->config_success_ = true;
 
 				// Only configure installation height if it's specified
 				if (this->has_installation_height_)
 				{
-					// Check current installation height
-					uint16_t current_installation_height;
-					if (modbus_read_register(REG_INSTALLATION_HEIGHT, current_installation_height))
-					{
-						ESP_LOGI(TAG, "Current installation height: %d cm", current_installation_height);
-
-						// Update if different
-						if (current_installation_height != this->installation_height_)
-						{
-							ESP_LOGI(TAG, "Setting installation height to %d cm", this->installation_height_);
-							if (!modbus_write_register(REG_INSTALLATION_HEIGHT, this->installation_height_))
-							{
-								ESP_LOGW(TAG, "Failed to set installation height");
-								success = false;
-							}
-						}
-					}
-					else
-					{
-						ESP_LOGW(TAG, "Failed to read current installation height");
-
-						// Try to set it anyway
-						ESP_LOGI(TAG, "Attempting to set installation height to %d cm", this->installation_height_);
-						if (!modbus_write_register(REG_INSTALLATION_HEIGHT, this->installation_height_))
-						{
-							ESP_LOGW(TAG, "Failed to set installation height");
-							success = false;
-						}
-					}
+					verify_setting<InstallationHeightRegister>(this->installation_height_);
 				}
+				verify_setting<RangeRegister>(this->range_);
+			}
+
+			// Check the current value of a setting and update it if different
+			template <typename Register>
+			void verify_setting(uint16_t wanted)
+			{
+				static_assert(Register::WRITABLE, "Only writable registers can be configured");
+				verify_setting(register_info<Register>(), wanted);
+			}
 
-				// Check current range
-				uint16_t current_range;
-				if (modbus_read_register(REG_RANGE, current_range))
+			void verify_setting(const RegisterInfo &info, uint16_t wanted)
+			{
+				bool queued = this->bus_->read_registers(this, info.address, 1,
+														 [this, info, wanted](const ModbusResponse &response)
+														 {
+															 if (response.result == MODBUS_OK)
+															 {
+																 ESP_LOGI(TAG, "Current %s: %d %s", info.name, response.values[0], info.unit);
+																 if (!info.is_valid(response.values[0]))
+																 {
+																	 ESP_LOGW(TAG, "Sensor's %s is outside %d to %d %s", info.name, info.min, info.max, info.unit);
+																 }
+
+																 // Update if different
+																 if (response.values[0] != wanted)
+																 {
+																	 ESP_LOGI(TAG, "Setting %s to %d %s", info.name, wanted, info.unit);
+																	 write_setting(info, wanted);
+																 }
+															 }
+															 else
+															 {
+																 ESP_LOGW(TAG, "Failed to read current %s", info.name);
+
+																 // Try to set it anyway
+																 ESP_LOGI(TAG, "Attempting to set %s to %d %s", info.name, wanted, info.unit);
+																 write_setting(info, wanted);
+															 }
+															 config_request_done();
+														 });
+				config_request_queued(queued);
+			}
+
+			// The sensor echoes a successful write, the master checks the echo
+			void write_setting(const RegisterInfo &info, uint16_t value)
+			{
+				if (!info.is_valid(value))
 				{
-					ESP_LOGI(TAG, "Current range: %d m", current_range);
+					ESP_LOGE(TAG, "Can't set %s to %d %s, valid range is %d to %d", info.name, value, info.unit, info.min, info.max);
+					this->config_success_ = false;
+					return;
+				}
 
-					// Update if different
-					if (current_range != this->range_)
-					{
-						ESP_LOGI(TAG, "Setting range to %d m", this->range_);
-						if (!modbus_write_register(REG_RANGE, this->range_))
-						{
-							ESP_LOGW(TAG, "Failed to set range");
-							success = false;
-						}
-					}
+				bool queued = this->bus_->write_register(this, info.address, value,
+														 [this, info](const ModbusResponse &response)
+														 {
+															 if (response.result != MODBUS_OK)
+															 {
+																 ESP_LOGW(TAG, "Failed to set %s", info.name);
+																 this->config_success_ = false;
+															 }
+															 config_request_done();
+														 });
+				config_request_queued(queued);
+			}
+
+			void config_request_queued(bool queued)
+			{
+				if (queued)
+				{
+					this->config_outstanding_++;
 				}
 				else
 				{
-					ESP_LOGW(TAG, "Failed to read current range");
+					this->config_success_ = false;
+				}
+			}
 
-					// Try to set it anyway
-					ESP_LOGI(TAG, "Attempting to set range to %d m", this->range_);
-					if (!modbus_write_register(REG_RANGE, this->range_))
-					{
-						ESP_LOGW(TAG, "Failed to set range");
-						success = false;
-					}
+			void config_request_done()
+			{
+				this->config_outstanding_--;
+				if (this->config_outstanding_ == 0)
+				{
+					finish_configuration();
 				}
+			}
 
-				// Update device address if not default (and only if other settings are successful)
-				if (success && this->modbus_address_ != 0x01)
+			ConfigShadow wanted_config() const
+			{
+				return {this->modbus_address_, this->has_installation_height_,
+						this->has_installation_height_ ? this->installation_height_ : (uint16_t)0, this->range_};
+			}
+
+			void finish_configuration()
+			{
+				this->setup_complete_ = this->config_success_;
+				if (this->config_success_)
 				{
-					// We can only change the address if we're communicating successfully with the current address
-					ESP_LOGI(TAG, "Setting device address to 0x%02X", this->modbus_address_);
-					if (!modbus_write_register(REG_DEVICE_ADDRESS, this->modbus_address_))
-					{
-						ESP_LOGW(TAG, "Failed to set device address");
-						success = false;
-					}
+					ESP_LOGI(TAG, "HLK-LD8001H setup complete");
+					save_config_shadow(wanted_config());
 				}
+				else
+				{
+					ESP_LOGW(TAG, "HLK-LD8001H setup incomplete - will retry next update");
 
-				return success;
+					// Verify everything at the next boot too. Address 0 never matches.
+					save_config_shadow(ConfigShadow{});
+				}
+			}
+
+			// Flash is only written when the shadow changes
+			void save_config_shadow(const ConfigShadow &shadow)
+			{
+				if (shadow != this->config_shadow_)
+				{
+					this->config_shadow_ = shadow;
+					this->config_pref_.save(&this->config_shadow_);
+				}
 			}
 		};
 
 	} // namespace hlk_ld8001h
-} // namespace esphome
\ No newline at end of file
+} // namespace esphome
@@ -0,0 +1,567 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/uart/uart.h"
+#include "modbus_master.h"
+#include "registers.h"
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		static const char *const BUS_TAG = "hlk_ld8001h.bus";
+
+		// A device sharing the bus. The bus calls run_bus_turn() when it's the
+		// device's turn, and the device queues its transactions from there.
+		class ModbusBusClient
+		{
+		public:
+			virtual uint8_t get_modbus_address() const = 0;
+			// Work waiting for the bus, and since when (millis)
+			virtual bool has_bus_work() const = 0;
+			virtual uint32_t bus_work_since() const = 0;
+			virtual void run_bus_turn() = 0;
+			// Discovery found the device at this address
+			virtual void on_discovered(uint8_t address) = 0;
+
+			bool is_isolated() const { return this->bus_failures_ >= ISOLATION_THRESHOLD; }
+			const ModbusStats &get_link_stats() const { return this->link_stats_; }
+
+		protected:
+			friend class ModbusBus;
+
+			static const uint8_t ISOLATION_THRESHOLD = 3; // Failed transactions in a row
+
+			uint8_t bus_failures_{0};
+			uint32_t bus_retry_at_{0};
+			uint32_t bus_backoff_{0};
+			ModbusStats link_stats_;
+		};
+
+		// One RS485/UART line shared by every LD8001H configured on the same UART.
+		// Only one device has transactions queued at a time. When its chain of
+		// requests is done, the device whose poll has waited longest gets the bus
+		// next, so a sensor with a short update interval can't starve the others.
+		// A device that stops answering is isolated: its requests get a single
+		// attempt and it only gets the bus again after a growing backoff.
+		//
+		// With an upgrade baud rate set, the bus first moves every sensor to that
+		// rate (see negotiate_baud_rate()) and remembers the agreed rate, so later
+		// boots start at it.
+		//
+		// Transaction counters are kept for the bus and for each device, and
+		// logged every few minutes while the bus is in use.
+		//
+		// discover() finds a sensor whose address or baud rate doesn't match the
+		// configuration. Alone on the bus, it's asked through the broadcast
+		// address at each baud rate. With others on the bus a broadcast would
+		// make them all answer at once, so every free address is tried instead.
+		class ModbusBus : public Component, public uart::UARTDevice
+		{
+		public:
+			ModbusBus() { this->master_.set_uart(this); }
+
+			void register_client(ModbusBusClient *client) { this->clients_.push_back(client); }
+			void set_bus_id(const std::string &bus_id) { this->pref_key_ = fnv1_hash("hlk_ld8001h_baud_" + bus_id); }
+			void set_upgrade_baud_rate(uint32_t baud_rate) { this->upgrade_baud_rate_ = baud_rate; }
+
+			float get_setup_priority() const override { return setup_priority::DATA; }
+
+			void setup() override
+			{
+				this->base_baud_rate_ = this->parent_->get_baud_rate();
+				this->master_.set_baud_rate(this->base_baud_rate_);
+
+				// Start where the last negotiation or discovery ended
+				this->baud_pref_ = global_preferences->make_preference<uint32_t>(this->pref_key_);
+				if (this->baud_pref_.load(&this->saved_baud_rate_) && this->saved_baud_rate_ != 0 &&
+					this->saved_baud_rate_ != this->base_baud_rate_)
+				{
+					ESP_LOGD(BUS_TAG, "Starting at previously agreed %u baud", (unsigned)this->saved_baud_rate_);
+					switch_baud_rate(this->saved_baud_rate_);
+				}
+
+				// Check a rate other than the configured one still holds, and upgrade if asked
+				if (this->upgrade_baud_rate_ != 0 || this->parent_->get_baud_rate() != this->base_baud_rate_)
+				{
+					this->baud_state_ = BAUD_PENDING;
+				}
+			}
+
+			// Find client's device, whatever its address and baud rate
+			void discover(ModbusBusClient *client)
+			{
+				if (this->discovery_client_ != nullptr)
+				{
+					ESP_LOGW(BUS_TAG, "Discovery already running");
+					return;
+				}
+				this->discovery_client_ = client;
+				this->discovery_pending_ = true;
+			}
+
+			void dump_config() override
+			{
+				ESP_LOGCONFIG(BUS_TAG, "HLK-LD8001H Modbus Bus:");
+				ESP_LOGCONFIG(BUS_TAG, "  Devices: %u", (unsigned)this->clients_.size());
+				for (auto *client : this->clients_)
+				{
+					ESP_LOGCONFIG(BUS_TAG, "    Address 0x%02X", client->get_modbus_address());
+				}
+				ESP_LOGCONFIG(BUS_TAG, "  Baud Rate: %u", (unsigned)this->parent_->get_baud_rate());
+				if (this->upgrade_baud_rate_ != 0)
+				{
+					ESP_LOGCONFIG(BUS_TAG, "  Upgrade Baud Rate: %u", (unsigned)this->upgrade_baud_rate_);
+				}
+				check_uart_settings(this->parent_->get_baud_rate());
+			}
+
+			void loop() override
+			{
+				this->master_.loop();
+				log_stats();
+
+				// The current device still has requests in flight, or follow-ups queued
+				if (!this->master_.is_idle())
+					return;
+
+				// Sensors only get the bus once everyone talks at the same rate
+				if (this->baud_state_ == BAUD_PENDING)
+				{
+					this->baud_state_ = BAUD_NEGOTIATING;
+					negotiate_baud_rate();
+					return;
+				}
+				if (this->baud_state_ != BAUD_DONE)
+					return;
+
+				if (this->discovery_pending_)
+				{
+					this->discovery_pending_ = false;
+					start_discovery();
+					return;
+				}
+				if (this->discovery_client_ != nullptr)
+					return;
+
+				ModbusBusClient *next = next_client();
+				if (next != nullptr)
+				{
+					next->run_bus_turn();
+				}
+			}
+
+			bool read_registers(ModbusBusClient *client, uint16_t reg, uint8_t count, ModbusCallback callback)
+			{
+				return this->master_.read_registers(client->get_modbus_address(), reg, count,
+													track(client, std::move(callback)), attempts(client), DEFAULT_TURNAROUND_TIME,
+													&client->link_stats_);
+			}
+
+			bool write_register(ModbusBusClient *client, uint16_t reg, uint16_t value, ModbusCallback callback)
+			{
+				return this->master_.write_register(client->get_modbus_address(), reg, value,
+													track(client, std::move(callback)), attempts(client), DEFAULT_TURNAROUND_TIME,
+													&client->link_stats_);
+			}
+
+		protected:
+			static const uint32_t MIN_BACKOFF = 5000;	// ms
+			static const uint32_t MAX_BACKOFF = 300000; // ms
+			// A probe needs no margin for a slow answer, a device that's there answers within a few ms
+			static const uint32_t DISCOVERY_TURNAROUND = 20000; // us
+			static const uint32_t STATS_LOG_INTERVAL = 300000;	// ms
+			static const size_t SUPPORTED_BAUD_RATE_COUNT = sizeof(SUPPORTED_BAUD_RATES) / sizeof(SUPPORTED_BAUD_RATES[0]);
+
+			enum BaudState : uint8_t
+			{
+				BAUD_DONE = 0,
+				BAUD_PENDING,
+				BAUD_NEGOTIATING,
+			};
+
+			using AnsweredCallback = std::function<void(uint8_t answered)>;
+
+			ModbusMaster master_;
+			std::vector<ModbusBusClient *> clients_;
+
+			// Baud rate negotiation
+			BaudState baud_state_{BAUD_DONE};
+			uint32_t base_baud_rate_{115200}; // The UART's configured rate
+			uint32_t upgrade_baud_rate_{0};	  // 0 if disabled
+			uint32_t saved_baud_rate_{0};
+			uint32_t pref_key_{0};
+			ESPPreferenceObject baud_pref_;
+			uint32_t candidates_[3];
+			uint8_t candidate_count_{0};
+
+			// Discovery
+			ModbusBusClient *discovery_client_{nullptr};
+			bool discovery_pending_{false};
+			uint32_t discovery_start_rate_{0};
+			uint32_t discovery_started_{0};
+
+			uint32_t stats_logged_at_{0};
+			uint32_t stats_logged_requests_{0};
+
+			// Find the rate the sensors answer at: the one we started at, the
+			// configured one, then the upgrade rate in case a sensor kept it
+			// after its settings were lost on our side.
+			void negotiate_baud_rate()
+			{
+				this->candidate_count_ = 0;
+				for (uint32_t rate : {this->parent_->get_baud_rate(), this->base_baud_rate_, this->upgrade_baud_rate_})
+				{
+					bool seen = rate == 0;
+					for (uint8_t i = 0; i < this->candidate_count_; i++)
+					{
+						seen |= this->candidates_[i] == rate;
+					}
+					if (!seen)
+					{
+						this->candidates_[this->candidate_count_++] = rate;
+					}
+				}
+				probe_baud_rate(0);
+			}
+
+			void probe_baud_rate(uint8_t index)
+			{
+				if (index >= this->candidate_count_)
+				{
+					ESP_LOGW(BUS_TAG, "No sensor answered at any known baud rate, staying at %u", (unsigned)this->base_baud_rate_);
+					switch_baud_rate(this->base_baud_rate_);
+					this->baud_state_ = BAUD_DONE;
+					return;
+				}
+
+				switch_baud_rate(this->candidates_[index]);
+				request_all(MODBUS_READ_HOLDING_REGISTERS, BaudRateRegister::ADDRESS, 1,
+							[this, index](uint8_t answered)
+							{
+								if (answered == 0)
+								{
+									probe_baud_rate(index + 1);
+									return;
+								}
+								upgrade_baud_rate(answered);
+							});
+			}
+
+			// Tell every sensor to switch, follow them and check they all answer.
+			// Each sensor answers the write at the old rate, then switches.
+			void upgrade_baud_rate(uint8_t answered)
+			{
+				uint32_t current = this->parent_->get_baud_rate();
+				save_baud_rate(current);
+
+				if (this->upgrade_baud_rate_ == 0 || current == this->upgrade_baud_rate_)
+				{
+					ESP_LOGI(BUS_TAG, "Bus running at %u baud", (unsigned)current);
+					this->baud_state_ = BAUD_DONE;
+					return;
+				}
+				// Switching without a sensor would lose it
+				if (answered < this->clients_.size())
+				{
+					ESP_LOGW(BUS_TAG, "Only %u of %u sensors answered, staying at %u baud", answered,
+							 (unsigned)this->clients_.size(), (unsigned)current);
+					this->baud_state_ = BAUD_DONE;
+					return;
+				}
+
+				ESP_LOGI(BUS_TAG, "Switching bus from %u to %u baud", (unsigned)current, (unsigned)this->upgrade_baud_rate_);
+				request_all(MODBUS_WRITE_SINGLE_REGISTER, BaudRateRegister::ADDRESS, BaudRateRegister::to_raw(this->upgrade_baud_rate_),
+							[this, current](uint8_t)
+							{
+								switch_baud_rate(this->upgrade_baud_rate_);
+								request_all(MODBUS_READ_HOLDING_REGISTERS, BaudRateRegister::ADDRESS, 1,
+											[this, current](uint8_t answered)
+											{
+												if (answered == this->clients_.size())
+												{
+													ESP_LOGI(BUS_TAG, "Bus running at %u baud", (unsigned)this->upgrade_baud_rate_);
+													save_baud_rate(this->upgrade_baud_rate_);
+													this->baud_state_ = BAUD_DONE;
+													return;
+												}
+												ESP_LOGW(BUS_TAG, "Only %u of %u sensors answered at %u baud, switching back to %u", answered,
+														 (unsigned)this->clients_.size(), (unsigned)this->upgrade_baud_rate_, (unsigned)current);
+												revert_baud_rate(current);
+											});
+							});
+			}
+
+			// Sensors that switched are sent back first. The write is repeated at the
+			// old rate so sensors that stored the new rate without switching don't
+			// pick it up at their next power cycle.
+			void revert_baud_rate(uint32_t rate)
+			{
+				request_all(MODBUS_WRITE_SINGLE_REGISTER, BaudRateRegister::ADDRESS, BaudRateRegister::to_raw(rate),
+							[this, rate](uint8_t)
+							{
+								switch_baud_rate(rate);
+								request_all(MODBUS_WRITE_SINGLE_REGISTER, BaudRateRegister::ADDRESS, BaudRateRegister::to_raw(rate),
+											[this, rate](uint8_t answered)
+											{
+												if (answered < this->clients_.size())
+												{
+													ESP_LOGW(BUS_TAG, "Only %u of %u sensors answer at %u baud", answered,
+															 (unsigned)this->clients_.size(), (unsigned)rate);
+												}
+												save_baud_rate(rate);
+												this->baud_state_ = BAUD_DONE;
+											});
+							});
+			}
+
+			void start_discovery()
+			{
+				this->discovery_start_rate_ = this->parent_->get_baud_rate();
+				this->discovery_started_ = millis();
+				if (this->clients_.size() == 1)
+				{
+					ESP_LOGI(BUS_TAG, "Discovering the sensor through the broadcast address");
+					probe_broadcast(0);
+				}
+				else
+				{
+					ESP_LOGI(BUS_TAG, "Discovering the sensor by address at %u baud", (unsigned)this->discovery_start_rate_);
+					probe_address(DeviceAddressRegister::MIN);
+				}
+			}
+
+			// Index 0 is the current rate, then every supported rate
+			void probe_broadcast(size_t index)
+			{
+				for (; index <= SUPPORTED_BAUD_RATE_COUNT; index++)
+				{
+					if (index == 0 || SUPPORTED_BAUD_RATES[index - 1] != this->discovery_start_rate_)
+						break;
+				}
+				if (index > SUPPORTED_BAUD_RATE_COUNT)
+				{
+					finish_discovery(false, 0);
+					return;
+				}
+
+				switch_baud_rate(index == 0 ? this->discovery_start_rate_ : SUPPORTED_BAUD_RATES[index - 1]);
+				bool queued = this->master_.read_registers(MODBUS_BROADCAST_ADDRESS, DeviceAddressRegister::ADDRESS, 1,
+														   [this, index](const ModbusResponse &response)
+														   {
+															   if (response.result == MODBUS_OK)
+															   {
+																   finish_discovery(true, response.values[0]);
+																   return;
+															   }
+															   probe_broadcast(index + 1);
+														   },
+														   1, DISCOVERY_TURNAROUND);
+				if (!queued)
+				{
+					finish_discovery(false, 0);
+				}
+			}
+
+			void probe_address(uint16_t address)
+			{
+				// Addresses that belong to the other sensors are skipped, they'd answer
+				for (; address <= DeviceAddressRegister::MAX; address++)
+				{
+					bool taken = false;
+					for (auto *client : this->clients_)
+					{
+						taken |= client != this->discovery_client_ && client->get_modbus_address() == address;
+					}
+					if (!taken)
+						break;
+				}
+				if (address > DeviceAddressRegister::MAX)
+				{
+					finish_discovery(false, 0);
+					return;
+				}
+
+				// Any answer will do, an exception still proves the address is in use
+				bool queued = this->master_.read_registers(address, DeviceAddressRegister::ADDRESS, 1,
+														   [this, address](const ModbusResponse &response)
+														   {
+															   if (response.result == MODBUS_OK || response.result == MODBUS_EXCEPTION)
+															   {
+																   finish_discovery(true, address);
+																   return;
+															   }
+															   probe_address(address + 1);
+														   },
+														   1, DISCOVERY_TURNAROUND);
+				if (!queued)
+				{
+					finish_discovery(false, 0);
+				}
+			}
+
+			void finish_discovery(bool found, uint16_t address)
+			{
+				ModbusBusClient *client = this->discovery_client_;
+				this->discovery_client_ = nullptr;
+				uint32_t elapsed = millis() - this->discovery_started_;
+
+				if (!found || !DeviceAddressRegister::is_valid(address))
+				{
+					ESP_LOGW(BUS_TAG, "No sensor found after %ums", (unsigned)elapsed);
+					switch_baud_rate(this->discovery_start_rate_);
+					return;
+				}
+
+				uint32_t rate = this->parent_->get_baud_rate();
+				ESP_LOGI(BUS_TAG, "Found sensor at address 0x%02X, %u baud in %ums", address, (unsigned)rate, (unsigned)elapsed);
+				save_baud_rate(rate);
+				client->bus_failures_ = 0;
+				client->bus_backoff_ = 0;
+				client->on_discovered(address);
+			}
+
+			// Send the same request to every sensor in turn, then report how many answered
+			void request_all(uint8_t function, uint16_t reg, uint16_t value, AnsweredCallback done, size_t index = 0,
+							 uint8_t answered = 0)
+			{
+				if (index >= this->clients_.size())
+				{
+					done(answered);
+					return;
+				}
+
+				uint8_t address = this->clients_[index]->get_modbus_address();
+				ModbusCallback next = [this, function, reg, value, done, index, answered](const ModbusResponse &response)
+				{ request_all(function, reg, value, done, index + 1, answered + (response.result == MODBUS_OK ? 1 : 0)); };
+
+				bool queued = function == MODBUS_WRITE_SINGLE_REGISTER
+								  ? this->master_.write_register(address, reg, value, next, 2)
+								  : this->master_.read_registers(address, reg, value, next, 2);
+				if (!queued)
+				{
+					request_all(function, reg, value, done, index + 1, answered);
+				}
+			}
+
+			void switch_baud_rate(uint32_t baud_rate)
+			{
+				if (this->parent_->get_baud_rate() != baud_rate)
+				{
+					this->parent_->set_baud_rate(baud_rate);
+					this->parent_->load_settings(false);
+				}
+				this->master_.set_baud_rate(baud_rate);
+			}
+
+			void save_baud_rate(uint32_t baud_rate)
+			{
+				if (baud_rate == this->saved_baud_rate_)
+					return;
+				this->saved_baud_rate_ = baud_rate;
+				this->baud_pref_.save(&this->saved_baud_rate_);
+			}
+
+			void log_stats()
+			{
+				uint32_t now = millis();
+				if (now - this->stats_logged_at_ < STATS_LOG_INTERVAL)
+					return;
+				this->stats_logged_at_ = now;
+
+				// Nothing new to report
+				const ModbusStats &total = this->master_.get_stats();
+				if (total.requests == this->stats_logged_requests_)
+					return;
+				this->stats_logged_requests_ = total.requests;
+
+				total.log(BUS_TAG, "Bus");
+				char name[16];
+				for (auto *client : this->clients_)
+				{
+					snprintf(name, sizeof(name), "Device 0x%02X", client->get_modbus_address());
+					client->link_stats_.log(BUS_TAG, name);
+				}
+			}
+
+			// Oldest pending work first; ties go to the device registered first
+			ModbusBusClient *next_client() const
+			{
+				uint32_t now = millis();
+				ModbusBusClient *next = nullptr;
+				uint32_t longest_wait = 0;
+				for (auto *client : this->clients_)
+				{
+					if (!client->has_bus_work())
+						continue;
+					if (client->is_isolated() && (int32_t)(client->bus_retry_at_ - now) > 0)
+						continue;
+
+					uint32_t wait = now - client->bus_work_since();
+					if (next == nullptr || wait > longest_wait)
+					{
+						next = client;
+						longest_wait = wait;
+					}
+				}
+				return next;
+			}
+
+			uint8_t attempts(const ModbusBusClient *client) const { return client->is_isolated() ? 1 : 3; }
+
+			ModbusCallback track(ModbusBusClient *client, ModbusCallback &&callback)
+			{
+				return [this, client, callback = std::move(callback)](const ModbusResponse &response)
+				{
+					record_result(client, response.result);
+					if (callback)
+					{
+						callback(response);
+					}
+				};
+			}
+
+			void record_result(ModbusBusClient *client, ModbusResult result)
+			{
+				// An exception is still an answer, the device is alive
+				if (result == MODBUS_OK || result == MODBUS_EXCEPTION)
+				{
+					if (client->is_isolated())
+					{
+						ESP_LOGI(BUS_TAG, "Device 0x%02X is responding again", client->get_modbus_address());
+					}
+					client->bus_failures_ = 0;
+					client->bus_backoff_ = 0;
+					return;
+				}
+
+				uint32_t now = millis();
+				if (client->bus_failures_ < ModbusBusClient::ISOLATION_THRESHOLD)
+				{
+					client->bus_failures_++;
+					if (!client->is_isolated())
+						return;
+				}
+				else if ((int32_t)(client->bus_retry_at_ - now) > 0)
+				{
+					return; // Already backed off for this turn
+				}
+
+				uint32_t backoff = client->bus_backoff_ == 0 ? MIN_BACKOFF : client->bus_backoff_ * 2;
+				client->bus_backoff_ = backoff < MAX_BACKOFF ? backoff : MAX_BACKOFF;
+				client->bus_retry_at_ = now + client->bus_backoff_;
+				ESP_LOGW(BUS_TAG, "Device 0x%02X not responding, next attempt in %us", client->get_modbus_address(),
+						 (unsigned)(client->bus_backoff_ / 1000));
+			}
+		};
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -0,0 +1,570 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/components/uart/uart.h"
+#include "crc16.h"
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		static const char *const MODBUS_TAG = "hlk_ld8001h.modbus";
+
+		// MODBUS function codes
+		static const uint8_t MODBUS_READ_HOLDING_REGISTERS = 0x03;
+		static const uint8_t MODBUS_WRITE_SINGLE_REGISTER = 0x06;
+		static const uint8_t MODBUS_EXCEPTION_FLAG = 0x80;
+		static const uint8_t MAX_READ_REGISTERS = 8;
+		static const uint8_t MODBUS_BROADCAST_ADDRESS = 0xFF; // Answered by any LD8001H, whatever its address
+		static const uint32_t DEFAULT_TURNAROUND_TIME = 100000; // us the device may take before answering
+
+		enum ModbusResult : uint8_t
+		{
+			MODBUS_OK = 0,
+			MODBUS_NO_RESPONSE,
+			MODBUS_INCOMPLETE,
+			MODBUS_CRC_ERROR,
+			MODBUS_INVALID_RESPONSE,
+			MODBUS_EXCEPTION,
+		};
+		static const uint8_t MODBUS_RESULT_COUNT = MODBUS_EXCEPTION + 1;
+
+		// Exception codes a device answers with instead of the data
+		enum ModbusException : uint8_t
+		{
+			MODBUS_ILLEGAL_FUNCTION = 0x01,
+			MODBUS_ILLEGAL_DATA_ADDRESS = 0x02,
+			MODBUS_ILLEGAL_DATA_VALUE = 0x03, // Also a register count the device won't read at once
+			MODBUS_DEVICE_FAILURE = 0x04,
+			MODBUS_ACKNOWLEDGE = 0x05, // Accepted, but still working on it
+			MODBUS_DEVICE_BUSY = 0x06,
+		};
+
+		inline const char *exception_to_string(uint8_t code)
+		{
+			switch (code)
+			{
+			case MODBUS_ILLEGAL_FUNCTION:
+				return "illegal function";
+			case MODBUS_ILLEGAL_DATA_ADDRESS:
+				return "illegal data address";
+			case MODBUS_ILLEGAL_DATA_VALUE:
+				return "illegal data value";
+			case MODBUS_DEVICE_FAILURE:
+				return "device failure";
+			case MODBUS_ACKNOWLEDGE:
+				return "acknowledge";
+			case MODBUS_DEVICE_BUSY:
+				return "device busy";
+			default:
+				return "unknown exception";
+			}
+		}
+
+		// The same request can succeed a little later. Anything else will be
+		// rejected again, so it isn't retried.
+		inline bool is_retryable_exception(uint8_t code) { return code == MODBUS_ACKNOWLEDGE || code == MODBUS_DEVICE_BUSY; }
+
+		struct ModbusResponse
+		{
+			ModbusResult result;
+			uint8_t exception_code; // ModbusException, valid if result is MODBUS_EXCEPTION
+			uint8_t count;			// Registers requested (reads) or 1 (writes)
+			uint16_t values[MAX_READ_REGISTERS];
+		};
+
+		using ModbusCallback = std::function<void(const ModbusResponse &response)>;
+
+		// Upper bounds of the response latency buckets, from the start of the
+		// request to the last byte of the response. The last bucket takes the rest.
+		static const uint32_t LATENCY_BUCKET_LIMITS[] = {2000, 5000, 10000, 20000, 50000, 100000}; // us
+		static const uint8_t LATENCY_BUCKET_COUNT = sizeof(LATENCY_BUCKET_LIMITS) / sizeof(LATENCY_BUCKET_LIMITS[0]) + 1;
+
+		// Transaction counters, for the whole bus or one device. They only ever
+		// grow, and wrap after 2^32.
+		struct ModbusStats
+		{
+			uint32_t requests{0};
+			uint32_t retries{0};
+			uint32_t failures{0};						 // Requests that failed on every attempt
+			uint32_t results[MODBUS_RESULT_COUNT]{};	 // Attempts, by result
+			uint32_t read_results[MODBUS_RESULT_COUNT]{};	 // Of those, register reads (0x03)
+			uint32_t write_results[MODBUS_RESULT_COUNT]{}; // and register writes (0x06)
+			uint32_t latency[LATENCY_BUCKET_COUNT]{};	 // Complete responses, by latency
+			uint32_t max_latency{0};					 // us
+			uint32_t history{0};						 // Last attempts, bit set if answered
+			uint8_t history_length{0};
+
+			void record_attempt(uint8_t function, ModbusResult result)
+			{
+				this->results[result]++;
+				if (function == MODBUS_READ_HOLDING_REGISTERS)
+				{
+					this->read_results[result]++;
+				}
+				else if (function == MODBUS_WRITE_SINGLE_REGISTER)
+				{
+					this->write_results[result]++;
+				}
+				// An exception is still a clean answer, the link is fine
+				this->history = (this->history << 1) | (result == MODBUS_OK || result == MODBUS_EXCEPTION ? 1 : 0);
+				if (this->history_length < HISTORY_SIZE)
+				{
+					this->history_length++;
+				}
+			}
+
+			void record_request(bool succeeded)
+			{
+				this->requests++;
+				if (!succeeded)
+				{
+					this->failures++;
+				}
+			}
+
+			void record_latency(uint32_t latency)
+			{
+				uint8_t bucket = 0;
+				while (bucket < LATENCY_BUCKET_COUNT - 1 && latency > LATENCY_BUCKET_LIMITS[bucket])
+				{
+					bucket++;
+				}
+				this->latency[bucket]++;
+				if (latency > this->max_latency)
+				{
+					this->max_latency = latency;
+				}
+			}
+
+			// Attempts that got no answer at all
+			uint32_t timeouts() const { return this->results[MODBUS_NO_RESPONSE]; }
+
+			// Attempts that got an answer, but not the one asked for: cut short,
+			// corrupted, not matching the request, or an exception
+			uint32_t errors() const
+			{
+				return this->results[MODBUS_INCOMPLETE] + this->results[MODBUS_CRC_ERROR] +
+					   this->results[MODBUS_INVALID_RESPONSE] + this->results[MODBUS_EXCEPTION];
+			}
+
+			// Share of the last attempts that got an answer, in percent, NAN before the first
+			float link_quality() const
+			{
+				if (this->history_length == 0)
+					return NAN;
+				uint32_t answered = 0;
+				for (uint8_t i = 0; i < this->history_length; i++)
+				{
+					answered += (this->history >> i) & 1;
+				}
+				return 100.0f * answered / this->history_length;
+			}
+
+			void log(const char *tag, const char *name) const
+			{
+				ESP_LOGD(tag, "%s: %u requests, %u retries, %u failed", name, (unsigned)this->requests, (unsigned)this->retries,
+						 (unsigned)this->failures);
+				log_results(tag, "Reads", this->read_results);
+				log_results(tag, "Writes", this->write_results);
+				ESP_LOGD(tag, "  Latency: <2ms %u, <5ms %u, <10ms %u, <20ms %u, <50ms %u, <100ms %u, more %u, max %.1fms",
+						 (unsigned)this->latency[0], (unsigned)this->latency[1], (unsigned)this->latency[2],
+						 (unsigned)this->latency[3], (unsigned)this->latency[4], (unsigned)this->latency[5],
+						 (unsigned)this->latency[6], this->max_latency / 1000.0f);
+			}
+
+		protected:
+			static const uint8_t HISTORY_SIZE = 32;
+
+			static void log_results(const char *tag, const char *name, const uint32_t *results)
+			{
+				ESP_LOGD(tag, "  %s: %u ok, %u no response, %u incomplete, %u CRC error, %u invalid, %u exception", name,
+						 (unsigned)results[MODBUS_OK], (unsigned)results[MODBUS_NO_RESPONSE],
+						 (unsigned)results[MODBUS_INCOMPLETE], (unsigned)results[MODBUS_CRC_ERROR],
+						 (unsigned)results[MODBUS_INVALID_RESPONSE], (unsigned)results[MODBUS_EXCEPTION]);
+			}
+		};
+		static_assert(LATENCY_BUCKET_COUNT == 7, "ModbusStats::log() prints every latency bucket");
+
+		struct ModbusRequest
+		{
+			uint8_t address;
+			uint8_t function;
+			uint16_t reg;
+			uint16_t value; // Register count for reads, value for writes
+			uint8_t max_attempts;
+			uint32_t turnaround; // us
+			ModbusCallback callback;
+			ModbusStats *stats; // Per device counters, on top of the bus totals
+		};
+
+		// MODBUS RTU master driven from loop(). Requests are queued and run one at a
+		// time: send the frame, collect the response as it arrives, validate it and
+		// hand the result to the request's callback. Nothing in here waits, so the
+		// rest of the node keeps running while the bus is busy.
+		//
+		// Bus timing follows the line speed: frames are separated by the t3.5
+		// silence, a response is done as soon as its expected length is in, and
+		// the timeouts scale with the character time.
+		//
+		// An exception response is complete after its 5 bytes. Exceptions that
+		// will recur, like an unsupported register, fail the request at once;
+		// a busy device is asked again after a short pause.
+		class ModbusMaster
+		{
+		public:
+			void set_uart(uart::UARTDevice *uart) { this->uart_ = uart; }
+
+			void set_baud_rate(uint32_t baud_rate)
+			{
+				// RTU characters are 11 bits: start, 8 data, parity or second stop, stop
+				this->char_time_ = (11 * 1000000 + baud_rate - 1) / baud_rate;
+
+				// Above 19200 baud the spec fixes t1.5 and t3.5 instead of scaling them
+				if (baud_rate > 19200)
+				{
+					this->t1_5_ = 750;
+					this->t3_5_ = 1750;
+				}
+				else
+				{
+					this->t1_5_ = this->char_time_ * 3 / 2;
+					this->t3_5_ = this->char_time_ * 7 / 2;
+				}
+			}
+
+			// Read count consecutive holding registers starting at reg
+			bool read_registers(uint8_t address, uint16_t reg, uint8_t count, ModbusCallback callback, uint8_t max_attempts = 3,
+								uint32_t turnaround = DEFAULT_TURNAROUND_TIME, ModbusStats *stats = nullptr)
+			{
+				if (count == 0 || count > MAX_READ_REGISTERS)
+				{
+					ESP_LOGE(MODBUS_TAG, "Can't read %d registers in one request", count);
+					return false;
+				}
+				return enqueue(address, MODBUS_READ_HOLDING_REGISTERS, reg, count, std::move(callback), max_attempts, turnaround,
+							   stats);
+			}
+
+			bool write_register(uint8_t address, uint16_t reg, uint16_t value, ModbusCallback callback, uint8_t max_attempts = 3,
+								uint32_t turnaround = DEFAULT_TURNAROUND_TIME, ModbusStats *stats = nullptr)
+			{
+				return enqueue(address, MODBUS_WRITE_SINGLE_REGISTER, reg, value, std::move(callback), max_attempts, turnaround,
+							   stats);
+			}
+
+			bool is_idle() const { return this->count_ == 0; }
+
+			// Totals for every transaction on the bus
+			const ModbusStats &get_stats() const { return this->stats_; }
+
+			void loop()
+			{
+				// Gaps are a couple of milliseconds, far below the normal loop interval
+				if (this->count_ > 0)
+				{
+					this->high_freq_.start();
+				}
+				else
+				{
+					this->high_freq_.stop();
+				}
+
+				if (this->waiting_)
+				{
+					receive();
+					return;
+				}
+
+				// Bytes nobody asked for, e.g. a late answer to a request that timed out.
+				// The line isn't idle until they stop.
+				while (this->uart_->available() > 0)
+				{
+					this->uart_->read();
+					this->last_activity_ = micros();
+				}
+
+				if (this->count_ == 0 || micros() - this->last_activity_ < this->t3_5_ + this->retry_delay_)
+					return;
+				send_request();
+			}
+
+		protected:
+			static const size_t QUEUE_SIZE = 8;
+			static const size_t REQUEST_SIZE = 8;
+			static const size_t MAX_RESPONSE_SIZE = 3 + 2 * MAX_READ_REGISTERS + 2; // header + data + CRC
+			// The UART driver hands received bytes over in chunks, after its FIFO
+			// fills or the line has been idle for a few characters
+			static const uint32_t RX_HANDOVER_CHARS = 12;
+			static const uint32_t BUSY_RETRY_DELAY = 20000; // us
+
+			uart::UARTDevice *uart_{nullptr};
+			ModbusRequest queue_[QUEUE_SIZE];
+			size_t head_{0};
+			size_t count_{0};
+			uint8_t attempt_{0};
+			bool waiting_{false};
+			uint32_t last_activity_{0}; // micros() of the last byte seen on the line
+			uint32_t sent_at_{0};
+			uint32_t response_timeout_{0};
+			uint32_t retry_delay_{0}; // us added to the frame gap before the next request
+			uint8_t request_[REQUEST_SIZE];
+			uint8_t response_[MAX_RESPONSE_SIZE];
+			size_t received_{0};
+			size_t expected_{0};
+			HighFrequencyLoopRequester high_freq_;
+			ModbusStats stats_;
+
+			// Timing in us, defaults for 115200 baud
+			uint32_t char_time_{96};
+			uint32_t t1_5_{750};
+			uint32_t t3_5_{1750};
+
+			bool enqueue(uint8_t address, uint8_t function, uint16_t reg, uint16_t value, ModbusCallback &&callback,
+						 uint8_t max_attempts, uint32_t turnaround, ModbusStats *stats)
+			{
+				if (this->count_ >= QUEUE_SIZE)
+				{
+					ESP_LOGE(MODBUS_TAG, "Request queue full, dropping request for register 0x%04X", reg);
+					return false;
+				}
+
+				ModbusRequest &request = this->queue_[(this->head_ + this->count_) % QUEUE_SIZE];
+				request.address = address;
+				request.function = function;
+				request.reg = reg;
+				request.value = value;
+				request.max_attempts = max_attempts;
+				request.turnaround = turnaround;
+				request.callback = std::move(callback);
+				request.stats = stats;
+				this->count_++;
+				return true;
+			}
+
+			void send_request()
+			{
+				ModbusRequest &request = this->queue_[this->head_];
+
+				this->request_[0] = request.address;	  // Modbus address
+				this->request_[1] = request.function;	  // Function code
+				this->request_[2] = request.reg >> 8;	  // Register address high byte
+				this->request_[3] = request.reg & 0xFF;	  // Register address low byte
+				this->request_[4] = request.value >> 8;	  // Count or value high byte
+				this->request_[5] = request.value & 0xFF; // Count or value low byte
+
+				// Calculate CRC
+				uint16_t crc = crc16_modbus(this->request_, 6);
+				this->request_[6] = crc & 0xFF; // CRC low byte
+				this->request_[7] = crc >> 8;	// CRC high byte
+
+				ESP_LOGV(MODBUS_TAG, "Sending function 0x%02X for register 0x%04X, value %d (attempt %d)", request.function,
+						 request.reg, request.value, this->attempt_ + 1);
+				this->uart_->write_array(this->request_, REQUEST_SIZE);
+
+				this->waiting_ = true;
+				this->retry_delay_ = 0;
+				this->received_ = 0;
+				this->expected_ = 3; // Address, function and byte count/first byte, they tell how much follows
+
+				// Time to send the request and receive a full answer, plus the device's turnaround
+				size_t answer = request.function == MODBUS_READ_HOLDING_REGISTERS ? 5 + 2 * request.value : REQUEST_SIZE;
+				this->response_timeout_ = (REQUEST_SIZE + answer) * this->char_time_ + request.turnaround;
+				this->sent_at_ = micros();
+				this->last_activity_ = this->sent_at_;
+			}
+
+			// Collect whatever part of the response has arrived
+			void receive()
+			{
+				uint32_t now = micros();
+				size_t available = this->uart_->available();
+				while (available > 0 && this->received_ < this->expected_)
+				{
+					size_t chunk = std::min(available, this->expected_ - this->received_);
+					if (!this->uart_->read_array(this->response_ + this->received_, chunk))
+						break;
+					this->received_ += chunk;
+					available -= chunk;
+					this->last_activity_ = now;
+
+					if (this->received_ == 3 && this->expected_ == 3)
+					{
+						this->expected_ = response_length();
+					}
+				}
+
+				if (this->received_ >= this->expected_ && this->expected_ > 3)
+				{
+					uint32_t latency = now - this->sent_at_;
+					update_stats(this->queue_[this->head_], [latency](ModbusStats &stats)
+								 { stats.record_latency(latency); });
+					finish_attempt(validate_response());
+					return;
+				}
+
+				if (this->received_ == 0)
+				{
+					if (now - this->sent_at_ >= this->response_timeout_)
+					{
+						finish_attempt(MODBUS_NO_RESPONSE);
+					}
+					return;
+				}
+
+				// A response that went quiet for longer than t1.5 won't be completed,
+				// allowing for the driver's receive latency
+				if (now - this->last_activity_ >= this->t1_5_ + RX_HANDOVER_CHARS * this->char_time_)
+				{
+					finish_attempt(MODBUS_INCOMPLETE);
+				}
+			}
+
+			// Total response length, known once the first three bytes are in
+			size_t response_length() const
+			{
+				if (this->response_[1] & MODBUS_EXCEPTION_FLAG)
+					return 5; // Exception code + CRC
+				if (this->response_[1] == MODBUS_READ_HOLDING_REGISTERS)
+				{
+					// An oversized byte count fails validation, just don't read past the buffer
+					size_t length = 3 + this->response_[2] + 2;
+					return length < MAX_RESPONSE_SIZE ? length : MAX_RESPONSE_SIZE;
+				}
+				return 8; // Write echo
+			}
+
+			ModbusResult validate_response()
+			{
+				uint16_t expected_crc = (this->response_[this->expected_ - 1] << 8) | this->response_[this->expected_ - 2];
+				if (crc16_modbus(this->response_, this->expected_ - 2) != expected_crc)
+					return MODBUS_CRC_ERROR;
+
+				const ModbusRequest &request = this->queue_[this->head_];
+				if (request.address != MODBUS_BROADCAST_ADDRESS && this->response_[0] != request.address)
+					return MODBUS_INVALID_RESPONSE;
+				if (this->response_[1] == (request.function | MODBUS_EXCEPTION_FLAG))
+					return MODBUS_EXCEPTION;
+				if (this->response_[1] != request.function)
+					return MODBUS_INVALID_RESPONSE;
+
+				if (request.function == MODBUS_READ_HOLDING_REGISTERS)
+					return this->response_[2] == 2 * request.value ? MODBUS_OK : MODBUS_INVALID_RESPONSE;
+
+				// Writes echo the request
+				return memcmp(this->response_ + 1, this->request_ + 1, 5) == 0 ? MODBUS_OK : MODBUS_INVALID_RESPONSE;
+			}
+
+			void finish_attempt(ModbusResult result)
+			{
+				this->waiting_ = false;
+				ModbusRequest &request = this->queue_[this->head_];
+				update_stats(request, [&request, result](ModbusStats &stats)
+							 { stats.record_attempt(request.function, result); });
+
+				if (result != MODBUS_OK)
+				{
+					bool retry = true;
+					if (result == MODBUS_EXCEPTION)
+					{
+						uint8_t code = this->response_[2];
+						ESP_LOGW(MODBUS_TAG, "Device 0x%02X rejected register 0x%04X: %s (%d)", request.address, request.reg,
+								 exception_to_string(code), code);
+						retry = is_retryable_exception(code);
+					}
+					else
+					{
+						ESP_LOGW(MODBUS_TAG, "%s for register 0x%04X", result_to_string(result), request.reg);
+					}
+
+					// The frame gap in loop() spaces out the retry
+					this->attempt_++;
+					if (retry && this->attempt_ < request.max_attempts)
+					{
+						// A busy device gets longer to finish before it's asked again
+						if (result == MODBUS_EXCEPTION)
+						{
+							this->retry_delay_ = BUSY_RETRY_DELAY;
+						}
+						update_stats(request, [](ModbusStats &stats)
+									 { stats.retries++; });
+						return;
+					}
+					if (retry)
+					{
+						ESP_LOGW(MODBUS_TAG, "Failed to access register 0x%04X after %d attempts", request.reg, request.max_attempts);
+					}
+				}
+
+				update_stats(request, [result](ModbusStats &stats)
+							 { stats.record_request(result == MODBUS_OK); });
+
+				ModbusResponse response{};
+				response.result = result;
+				response.count = request.function == MODBUS_READ_HOLDING_REGISTERS ? request.value : 1;
+				if (result == MODBUS_EXCEPTION)
+				{
+					response.exception_code = this->response_[2];
+				}
+				else if (result == MODBUS_OK && request.function == MODBUS_READ_HOLDING_REGISTERS)
+				{
+					for (uint8_t i = 0; i < response.count; i++)
+					{
+						response.values[i] = (this->response_[3 + 2 * i] << 8) | this->response_[4 + 2 * i];
+					}
+				}
+				else if (result == MODBUS_OK)
+				{
+					response.values[0] = request.value;
+				}
+
+				// Pop before calling back, the callback may queue follow-up requests
+				ModbusCallback callback = std::move(request.callback);
+				this->head_ = (this->head_ + 1) % QUEUE_SIZE;
+				this->count_--;
+				this->attempt_ = 0;
+				this->retry_delay_ = 0; // Only ever for a retry, the next request owes the device nothing
+				if (callback)
+				{
+					callback(response);
+				}
+			}
+
+			// Count into the bus totals and the request's device
+			template <typename F>
+			void update_stats(const ModbusRequest &request, F update)
+			{
+				update(this->stats_);
+				if (request.stats != nullptr)
+				{
+					update(*request.stats);
+				}
+			}
+
+			static const char *result_to_string(ModbusResult result)
+			{
+				switch (result)
+				{
+				case MODBUS_NO_RESPONSE:
+					return "No response";
+				case MODBUS_INCOMPLETE:
+					return "Incomplete response";
+				case MODBUS_CRC_ERROR:
+					return "CRC error";
+				case MODBUS_INVALID_RESPONSE:
+					return "Invalid response";
+				default:
+					return "Error";
+				}
+			}
+		};
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "modbus_master.h"
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		enum RegisterAccess : uint8_t
+		{
+			REG_READ_ONLY = 0,
+			REG_READ_WRITE,
+		};
+
+		// A holding register of the sensor. Raw values times Scale give the value
+		// in the component's base unit (mm for distances, baud for the baud rate);
+		// Unit names the raw unit for logging. Values outside Min..Max are rejected
+		// before writing, rewritten when a setting reads back outside them, and
+		// dropped when a measurement does.
+		template <uint16_t Address, RegisterAccess Access, uint16_t Scale, uint16_t Min, uint16_t Max>
+		struct RegisterDescriptor
+		{
+			static constexpr uint16_t ADDRESS = Address;
+			static constexpr bool WRITABLE = Access == REG_READ_WRITE;
+			static constexpr uint16_t SCALE = Scale;
+			static constexpr uint16_t MIN = Min;
+			static constexpr uint16_t MAX = Max;
+
+			static constexpr bool is_valid(uint16_t raw) { return raw >= Min && raw <= Max; }
+			static constexpr uint32_t to_value(uint16_t raw) { return (uint32_t)raw * Scale; }
+			static constexpr uint16_t to_raw(uint32_t value) { return value / Scale; }
+		};
+
+		// MODBUS register map
+		struct SpaceHeightRegister : RegisterDescriptor<0x0001, REG_READ_ONLY, 1, 0, 40000>
+		{
+			static constexpr const char *NAME = "space height";
+			static constexpr const char *UNIT = "mm";
+		};
+		struct WaterLevelRegister : RegisterDescriptor<0x0003, REG_READ_ONLY, 1, 0, 40000>
+		{
+			static constexpr const char *NAME = "water level";
+			static constexpr const char *UNIT = "mm";
+		};
+		// Distance from radar to the tank bottom
+		struct InstallationHeightRegister : RegisterDescriptor<0x0005, REG_READ_WRITE, 10, 15, 4000>
+		{
+			static constexpr const char *NAME = "installation height";
+			static constexpr const char *UNIT = "cm";
+		};
+		// 0xFF is the broadcast address, not a valid setting
+		struct DeviceAddressRegister : RegisterDescriptor<0x03F4, REG_READ_WRITE, 1, 0x01, 0xFD>
+		{
+			static constexpr const char *NAME = "device address";
+			static constexpr const char *UNIT = "";
+		};
+		struct BaudRateRegister : RegisterDescriptor<0x03F6, REG_READ_WRITE, 100, 48, 1290>
+		{
+			static constexpr const char *NAME = "baud rate";
+			static constexpr const char *UNIT = "x100 baud";
+		};
+		// Maximum detection range
+		struct RangeRegister : RegisterDescriptor<0x07D4, REG_READ_WRITE, 1000, 0, 40>
+		{
+			static constexpr const char *NAME = "range";
+			static constexpr const char *UNIT = "m";
+		};
+
+		// Runtime description of a register, so the transaction code exists once
+		// rather than once per register
+		struct RegisterInfo
+		{
+			uint16_t address;
+			uint16_t min;
+			uint16_t max;
+			const char *name;
+			const char *unit;
+
+			bool is_valid(uint16_t raw) const { return raw >= this->min && raw <= this->max; }
+		};
+
+		template <typename Register>
+		constexpr RegisterInfo register_info()
+		{
+			return {Register::ADDRESS, Register::MIN, Register::MAX, Register::NAME, Register::UNIT};
+		}
+
+		// Rates BaudRateRegister accepts, fastest first
+		static const uint32_t SUPPORTED_BAUD_RATES[] = {129000, 115200, 57600, 56000, 38400, 19200, 14400, 9600, 4800};
+
+		// Registers read together in one request. The span from the lowest to the
+		// highest address is worked out at compile time, gaps included.
+		template <typename... Registers>
+		struct RegisterBlock
+		{
+			static constexpr uint16_t START = std::min({Registers::ADDRESS...});
+			static constexpr uint8_t COUNT = std::max({Registers::ADDRESS...}) - START + 1;
+			static_assert(COUNT <= MAX_READ_REGISTERS, "Register block too long for one request");
+
+			// Position of a register's value in the response
+			template <typename Register>
+			static constexpr uint8_t index_of() { return Register::ADDRESS - START; }
+		};
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -1,13 +1,21 @@
+import math
+
+from esphome import automation # type: ignore
 import esphome.codegen as cg # type: ignore
 import esphome.config_validation as cv # type: ignore
+import esphome.final_validate as fv # type: ignore
 from esphome.components import sensor, uart # type: ignore
 from esphome.const import ( # type: ignore
+    CONF_BAUD_RATE,
     CONF_ID,
+    CONF_PLATFORM,
+    CONF_TRIGGER_ID,
     CONF_UPDATE_INTERVAL,
     DEVICE_CLASS_DISTANCE,
     STATE_CLASS_MEASUREMENT,
     UNIT_MILLIMETER,
 )
+from esphome.core import CORE, ID # type: ignore
 
 DEPENDENCIES = ['uart']
 AUTO_LOAD = ['sensor']
@@ -16,14 +24,144 @@ CONF_INSTALLATION_HEIGHT = "installation_height"
 CONF_RANGE = "range"
 CONF_MODBUS_ADDRESS = "modbus_address"
 CONF_WATER_DEPTH_SENSOR = "water_depth_sensor"
+CONF_UPGRADE_BAUD_RATE = "upgrade_baud_rate"
+CONF_BURST = "burst"
+CONF_SAMPLES = "samples"
+CONF_AGGREGATE = "aggregate"
+CONF_SPREAD_SENSOR = "spread_sensor"
+CONF_VALID_SAMPLES_SENSOR = "valid_samples_sensor"
+CONF_LINK_QUALITY_SENSOR = "link_quality_sensor"
+CONF_LINK_ERRORS_SENSOR = "link_errors_sensor"
+CONF_LINK_TIMEOUTS_SENSOR = "link_timeouts_sensor"
+CONF_TANK = "tank"
+CONF_SHAPE = "shape"
+CONF_DIAMETER = "diameter"
+CONF_LENGTH = "length"
+CONF_WIDTH = "width"
+CONF_HEIGHT = "height"
+CONF_POINTS = "points"
+CONF_LEVEL = "level"
+CONF_VOLUME = "volume"
+CONF_VOLUME_SENSOR = "volume_sensor"
+CONF_PERCENT_SENSOR = "percent_sensor"
+CONF_CHANGE_THRESHOLD = "change_threshold"
+CONF_ADAPTIVE_POLLING = "adaptive_polling"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_ON_LEVEL_CHANGE = "on_level_change"
 
 # Validation constants from datasheet
 MIN_VALID_DISTANCE = 150  # mm
 MAX_VALID_DISTANCE = 40000  # mm
 DEFAULT_RANGE = 10  # m (10m)
+# Table points for a horizontal cylinder, linear interpolation between them
+# stays within 0.05% of the full volume
+HORIZONTAL_CYLINDER_SEGMENTS = 64
+# Rates the sensor accepts in REG_BAUD_RATE
+SUPPORTED_BAUD_RATES = [4800, 9600, 14400, 19200, 38400, 56000, 57600, 115200, 129000]
 
 hlk_ld8001h_ns = cg.esphome_ns.namespace('hlk_ld8001h')
 HLKLD8001HSensor = hlk_ld8001h_ns.class_('HLKLD8001HSensor', sensor.Sensor, cg.PollingComponent)
+ModbusBus = hlk_ld8001h_ns.class_('ModbusBus', cg.Component, uart.UARTDevice)
+DiscoverAction = hlk_ld8001h_ns.class_('DiscoverAction', automation.Action)
+BurstAggregate = hlk_ld8001h_ns.enum('BurstAggregate')
+TankPoint = hlk_ld8001h_ns.struct('TankPoint')
+LevelChangeTrigger = hlk_ld8001h_ns.class_('LevelChangeTrigger', automation.Trigger.template(cg.float_, cg.float_))
+
+BURST_AGGREGATES = {
+    "median": BurstAggregate.BURST_MEDIAN,
+    "trimmed_mean": BurstAggregate.BURST_TRIMMED_MEAN,
+}
+
+BURST_SCHEMA = cv.Schema({
+    cv.Optional(CONF_SAMPLES, default=5): cv.int_range(min=2, max=15),
+    cv.Optional(CONF_AGGREGATE, default="median"): cv.enum(BURST_AGGREGATES, lower=True),
+    cv.Optional(CONF_SPREAD_SENSOR): cv.use_id(sensor.Sensor),
+    cv.Optional(CONF_VALID_SAMPLES_SENSOR): cv.use_id(sensor.Sensor),
+})
+
+TANK_DIMENSION = cv.All(cv.distance, cv.Range(min=0.01, max=40.0))
+
+TANK_SENSORS_SCHEMA = cv.Schema({
+    cv.Optional(CONF_VOLUME_SENSOR): cv.use_id(sensor.Sensor),
+    cv.Optional(CONF_PERCENT_SENSOR): cv.use_id(sensor.Sensor),
+})
+
+def validate_tank_points(points):
+    for lower, upper in zip(points, points[1:]):
+        # The table holds whole mm
+        if round(upper[CONF_LEVEL] * 1000) <= round(lower[CONF_LEVEL] * 1000):
+            raise cv.Invalid("Tank points must be sorted by increasing level, at least 1mm apart")
+        if upper[CONF_VOLUME] < lower[CONF_VOLUME]:
+            raise cv.Invalid("Tank volume can't decrease as the level rises")
+    if points[-1][CONF_VOLUME] <= 0:
+        raise cv.Invalid("The last tank point needs a volume above 0")
+    return points
+
+TANK_SCHEMA = cv.typed_schema({
+    "vertical_cylinder": TANK_SENSORS_SCHEMA.extend({
+        cv.Required(CONF_DIAMETER): TANK_DIMENSION,
+        cv.Required(CONF_HEIGHT): TANK_DIMENSION,
+    }),
+    "horizontal_cylinder": TANK_SENSORS_SCHEMA.extend({
+        cv.Required(CONF_DIAMETER): TANK_DIMENSION,
+        cv.Required(CONF_LENGTH): TANK_DIMENSION,
+    }),
+    "rectangular": TANK_SENSORS_SCHEMA.extend({
+        cv.Required(CONF_LENGTH): TANK_DIMENSION,
+        cv.Required(CONF_WIDTH): TANK_DIMENSION,
+        cv.Required(CONF_HEIGHT): TANK_DIMENSION,
+    }),
+    "custom": TANK_SENSORS_SCHEMA.extend({
+        cv.Required(CONF_POINTS): cv.All(
+            cv.ensure_list(cv.Schema({
+                cv.Required(CONF_LEVEL): cv.All(cv.distance, cv.Range(min=0.0, max=40.0)),
+                cv.Required(CONF_VOLUME): cv.positive_float,  # l
+            })),
+            cv.Length(min=2),
+            validate_tank_points,
+        ),
+    }),
+}, key=CONF_SHAPE, lower=True)
+
+def tank_points(tank):
+    """Level (m) to volume (l) table for the tank"""
+    shape = tank[CONF_SHAPE]
+    if shape == "custom":
+        return [(point[CONF_LEVEL], point[CONF_VOLUME]) for point in tank[CONF_POINTS]]
+    if shape == "vertical_cylinder":
+        area = math.pi * (tank[CONF_DIAMETER] / 2) ** 2
+        return [(0.0, 0.0), (tank[CONF_HEIGHT], area * tank[CONF_HEIGHT] * 1000)]
+    if shape == "rectangular":
+        area = tank[CONF_LENGTH] * tank[CONF_WIDTH]
+        return [(0.0, 0.0), (tank[CONF_HEIGHT], area * tank[CONF_HEIGHT] * 1000)]
+
+    # Horizontal cylinder: the wetted part of the cross section is a circular segment
+    radius = tank[CONF_DIAMETER] / 2
+    points = []
+    for i in range(HORIZONTAL_CYLINDER_SEGMENTS + 1):
+        level = tank[CONF_DIAMETER] * i / HORIZONTAL_CYLINDER_SEGMENTS
+        segment = radius ** 2 * math.acos((radius - level) / radius) - (radius - level) * math.sqrt(
+            max(0.0, 2 * radius * level - level ** 2)
+        )
+        points.append((level, segment * tank[CONF_LENGTH] * 1000))
+    return points
+
+def validate_adaptive_polling(config):
+    if config[CONF_MIN_INTERVAL].total_milliseconds >= config[CONF_MAX_INTERVAL].total_milliseconds:
+        raise cv.Invalid("min_interval must be shorter than max_interval")
+    return config
+
+ADAPTIVE_POLLING_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Required(CONF_MIN_INTERVAL): cv.positive_time_period_milliseconds,
+        cv.Required(CONF_MAX_INTERVAL): cv.positive_time_period_milliseconds,
+    }),
+    validate_adaptive_polling,
+)
+
+# Sensors on the same UART share one bus, keyed by uart_id
+KEY_BUSES = "hlk_ld8001h_buses"
 
 def validate_config(config):
     # Validate installation_height is within range if provided
@@ -41,6 +179,22 @@ def validate_config(config):
     if range_mm > MAX_VALID_DISTANCE:
         raise cv.Invalid(f"range must be at most {MAX_VALID_DISTANCE}mm (got {range_mm}mm)")
     
+    # Polling starts at update_interval and stays within the adaptive bounds
+    if CONF_ADAPTIVE_POLLING in config:
+        adaptive = config[CONF_ADAPTIVE_POLLING]
+        update_ms = config[CONF_UPDATE_INTERVAL].total_milliseconds
+        min_ms = adaptive[CONF_MIN_INTERVAL].total_milliseconds
+        max_ms = adaptive[CONF_MAX_INTERVAL].total_milliseconds
+        if not min_ms <= update_ms <= max_ms:
+            raise cv.Invalid(
+                f"update_interval must be between min_interval and max_interval of adaptive_polling "
+                f"({min_ms}ms to {max_ms}ms, got {update_ms}ms)"
+            )
+
+    # Volume follows the water level, which needs the installation height
+    if CONF_TANK in config and CONF_INSTALLATION_HEIGHT not in config:
+        raise cv.Invalid("tank requires installation_height")
+
     # Validate modbus address
     if CONF_MODBUS_ADDRESS in config:
         modbus_address = config[CONF_MODBUS_ADDRESS]
@@ -64,32 +218,147 @@ CONFIG_SCHEMA = cv.All(
         cv.Optional(CONF_RANGE, default=f"{DEFAULT_RANGE}m"): cv.distance,
         cv.Optional(CONF_MODBUS_ADDRESS, default=0x01): cv.hex_uint8_t,
         cv.Optional(CONF_WATER_DEPTH_SENSOR): cv.use_id(sensor.Sensor),
+        cv.Optional(CONF_UPGRADE_BAUD_RATE): cv.one_of(*SUPPORTED_BAUD_RATES, int=True),
+        cv.Optional(CONF_BURST): BURST_SCHEMA,
+        cv.Optional(CONF_LINK_QUALITY_SENSOR): cv.use_id(sensor.Sensor),
+        cv.Optional(CONF_LINK_ERRORS_SENSOR): cv.use_id(sensor.Sensor),
+        cv.Optional(CONF_LINK_TIMEOUTS_SENSOR): cv.use_id(sensor.Sensor),
+        cv.Optional(CONF_TANK): TANK_SCHEMA,
+        cv.Optional(CONF_CHANGE_THRESHOLD, default="10mm"): cv.All(cv.distance, cv.Range(min=0.001, max=40.0)),
+        cv.Optional(CONF_ADAPTIVE_POLLING): ADAPTIVE_POLLING_SCHEMA,
+        cv.Optional(CONF_ON_LEVEL_CHANGE): automation.validate_automation({
+            cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(LevelChangeTrigger),
+        }),
     }),
     validate_config
 )
 
+def final_validate(config):
+    full_config = fv.full_config.get()
+    uart_id = config[uart.CONF_UART_ID]
+    bus_sensors = [
+        conf for conf in full_config.get("sensor", [])
+        if conf.get(CONF_PLATFORM) == "hlk_ld8001h" and conf[uart.CONF_UART_ID].id == uart_id.id
+    ]
+
+    # Every sensor on a shared bus needs its own address
+    if sum(conf[CONF_MODBUS_ADDRESS] == config[CONF_MODBUS_ADDRESS] for conf in bus_sensors) > 1:
+        raise cv.Invalid(
+            f"modbus_address {hex(config[CONF_MODBUS_ADDRESS])} is used by more than one hlk_ld8001h sensor on "
+            f"uart {uart_id}"
+        )
+
+    # The whole bus switches together
+    if CONF_UPGRADE_BAUD_RATE in config:
+        upgrade_rates = {conf[CONF_UPGRADE_BAUD_RATE] for conf in bus_sensors if CONF_UPGRADE_BAUD_RATE in conf}
+        if len(upgrade_rates) > 1:
+            raise cv.Invalid(f"All hlk_ld8001h sensors on uart {uart_id} must use the same upgrade_baud_rate")
+        for uart_conf in full_config.get("uart", []):
+            if uart_conf[CONF_ID].id == uart_id.id and config[CONF_UPGRADE_BAUD_RATE] <= uart_conf[CONF_BAUD_RATE]:
+                raise cv.Invalid(
+                    f"upgrade_baud_rate must be higher than the baud_rate of uart {uart_id} ({uart_conf[CONF_BAUD_RATE]})"
+                )
+    return config
+
+FINAL_VALIDATE_SCHEMA = final_validate
+
+async def get_bus(config):
+    uart_id = config[uart.CONF_UART_ID]
+    buses = CORE.data.setdefault(KEY_BUSES, {})
+    if uart_id.id not in buses:
+        # Stored before awaiting so a sensor generated meanwhile finds it
+        bus = cg.new_Pvariable(ID(f"{uart_id.id}_hlk_ld8001h_bus", is_declaration=True, type=ModbusBus))
+        buses[uart_id.id] = bus
+        cg.add(bus.set_bus_id(uart_id.id))
+        await cg.register_component(bus, {})
+        await uart.register_uart_device(bus, config)
+    return buses[uart_id.id]
+
+HLK_LD8001H_ACTION_SCHEMA = automation.maybe_simple_id({
+    cv.GenerateID(): cv.use_id(HLKLD8001HSensor),
+})
+
+@automation.register_action("hlk_ld8001h.discover", DiscoverAction, HLK_LD8001H_ACTION_SCHEMA)
+async def hlk_ld8001h_action_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await sensor.register_sensor(var, config)
     await cg.register_component(var, config)
-    await uart.register_uart_device(var, config)
+
+    bus = await get_bus(config)
+    cg.add(var.set_bus(bus))
+    cg.add(bus.register_client(var))
+    if CONF_UPGRADE_BAUD_RATE in config:
+        cg.add(bus.set_upgrade_baud_rate(config[CONF_UPGRADE_BAUD_RATE]))
     
     if CONF_INSTALLATION_HEIGHT in config:
-        # Convert from meters to centimeters (as per datasheet)
-        height_cm = int(config[CONF_INSTALLATION_HEIGHT] * 100)  # Convert to cm
-        cg.add(var.set_installation_height(height_cm))
+        # Passed in mm, the component converts to the register's cm
+        height_mm = round(config[CONF_INSTALLATION_HEIGHT] * 1000)
+        cg.add(var.set_installation_height(height_mm))
         cg.add(var.set_has_installation_height(True))
     else:
         cg.add(var.set_has_installation_height(False))
         
     if CONF_RANGE in config:
-        # Convert from meters to meters (as per datasheet)
-        range_m = int(config[CONF_RANGE])  # Convert to whole meters
-        cg.add(var.set_range(range_m))
+        # Passed in mm, the component converts to the register's whole meters
+        range_mm = round(config[CONF_RANGE] * 1000)
+        cg.add(var.set_range(range_mm))
         
     if CONF_MODBUS_ADDRESS in config:
         cg.add(var.set_modbus_address(config[CONF_MODBUS_ADDRESS]))
         
     if CONF_WATER_DEPTH_SENSOR in config:
         water_depth_sensor = await cg.get_variable(config[CONF_WATER_DEPTH_SENSOR])
-        cg.add(var.set_water_depth_sensor(water_depth_sensor))
\ No newline at end of file
+        cg.add(var.set_water_depth_sensor(water_depth_sensor))
+
+    if CONF_BURST in config:
+        burst = config[CONF_BURST]
+        cg.add(var.set_burst(burst[CONF_SAMPLES], burst[CONF_AGGREGATE]))
+        if CONF_SPREAD_SENSOR in burst:
+            spread_sensor = await cg.get_variable(burst[CONF_SPREAD_SENSOR])
+            cg.add(var.set_spread_sensor(spread_sensor))
+        if CONF_VALID_SAMPLES_SENSOR in burst:
+            valid_samples_sensor = await cg.get_variable(burst[CONF_VALID_SAMPLES_SENSOR])
+            cg.add(var.set_valid_samples_sensor(valid_samples_sensor))
+
+    if CONF_LINK_QUALITY_SENSOR in config:
+        link_quality_sensor = await cg.get_variable(config[CONF_LINK_QUALITY_SENSOR])
+        cg.add(var.set_link_quality_sensor(link_quality_sensor))
+
+    if CONF_LINK_ERRORS_SENSOR in config:
+        link_errors_sensor = await cg.get_variable(config[CONF_LINK_ERRORS_SENSOR])
+        cg.add(var.set_link_errors_sensor(link_errors_sensor))
+
+    if CONF_LINK_TIMEOUTS_SENSOR in config:
+        link_timeouts_sensor = await cg.get_variable(config[CONF_LINK_TIMEOUTS_SENSOR])
+        cg.add(var.set_link_timeouts_sensor(link_timeouts_sensor))
+
+    if CONF_TANK in config:
+        tank = config[CONF_TANK]
+        # The geometry is worked out here, the component only interpolates
+        points = tank_points(tank)
+        table = cg.static_const_array(
+            ID(f"{config[CONF_ID].id}_tank_table", is_declaration=True, type=TankPoint),
+            cg.ArrayInitializer(*[cg.ArrayInitializer(round(level * 1000), volume) for level, volume in points]),
+        )
+        cg.add(var.set_tank_table(table, len(points)))
+        if CONF_VOLUME_SENSOR in tank:
+            volume_sensor = await cg.get_variable(tank[CONF_VOLUME_SENSOR])
+            cg.add(var.set_volume_sensor(volume_sensor))
+        if CONF_PERCENT_SENSOR in tank:
+            percent_sensor = await cg.get_variable(tank[CONF_PERCENT_SENSOR])
+            cg.add(var.set_percent_sensor(percent_sensor))
+
+    # Passed in mm
+    cg.add(var.set_change_threshold(config[CONF_CHANGE_THRESHOLD] * 1000))
+    if CONF_ADAPTIVE_POLLING in config:
+        adaptive = config[CONF_ADAPTIVE_POLLING]
+        cg.add(var.set_adaptive_polling(int(adaptive[CONF_MIN_INTERVAL].total_milliseconds),
+                                        int(adaptive[CONF_MAX_INTERVAL].total_milliseconds)))
+    for conf in config.get(CONF_ON_LEVEL_CHANGE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(float, "x"), (float, "delta")], conf)
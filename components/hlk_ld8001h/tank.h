@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		// One point of a tank's level to volume table. sensor.py generates the
+		// table from the tank's shape, or takes it from the YAML for custom tanks.
+		struct TankPoint
+		{
+			uint16_t level; // mm, increasing through the table
+			float volume;	// l
+		};
+
+		// Volume at a water level, interpolated linearly between the table points.
+		// Levels outside the table give the volume at its ends.
+		inline float tank_volume(const TankPoint *table, size_t size, float level)
+		{
+			if (level <= table[0].level)
+				return table[0].volume;
+			if (level >= table[size - 1].level)
+				return table[size - 1].volume;
+
+			// First point above the level, there's always one below it
+			const TankPoint *upper = std::upper_bound(table, table + size, level,
+													  [](float value, const TankPoint &point)
+													  { return value < point.level; });
+			const TankPoint *lower = upper - 1;
+			float fraction = (level - lower->level) / (upper->level - lower->level);
+			return lower->volume + fraction * (upper->volume - lower->volume);
+		}
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "esphome/components/uart/uart.h"
+#include "esphome/core/component.h"
+#include "esphome/core/gpio.h"
+#include "host.h"
+#include "hlk_ld2413/hlk_ld2413.h"
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    // An HLK-LD2413 at the far end of a host UART. Once powered and warmed up it
+    // sends a data frame every report cycle, and it ACKs the commands the
+    // component uses, stopping the data frames while in config mode like the
+    // sensor. The level moves at a set rate with seeded noise, so a run can be
+    // repeated. Register it with host::register_component() so it runs.
+    class LD2413Emulator : public Component
+    {
+    public:
+      explicit LD2413Emulator(uart::UARTComponent *uart, uint32_t seed = 1) : uart_(uart), random_(seed)
+      {
+        uart->add_on_transmit_callback([this](const uint8_t *data, size_t len)
+                                       { this->on_transmit(data, len); });
+      }
+
+      float distance{1500.0f}; // mm, the true level
+      float rate{0.0f};        // mm/min the distance changes by, negative while filling
+      float noise{0.0f};       // mm, readings are off by up to this much either way
+      uint16_t report_cycle{160};  // ms
+      uint32_t warmup{300};        // ms from power up to the first frame
+      uint32_t latency{2000};      // us from a command to its ACK
+      uint8_t failing_commands{0}; // Answers this many commands with a failure status
+      uint16_t refused_command{0xFFFF}; // Answers every request of this command with a failure status
+      bool silent{false};          // Powered, answers commands, but sends no data frames
+      GPIOPin *power_pin{nullptr}; // Powered all the time without one
+
+      // What the sensor saw and sent
+      uint32_t frames_sent{0};
+      uint32_t power_ups{0};
+      std::vector<uint16_t> commands;
+
+      bool is_powered() const { return this->power_pin == nullptr || this->power_pin->digital_read(); }
+
+      void loop() override
+      {
+        uint32_t now = millis();
+        if (!is_powered())
+        {
+          this->was_powered_ = false;
+          this->config_mode_ = false;
+          return;
+        }
+        if (!this->was_powered_)
+        {
+          this->was_powered_ = true;
+          this->power_ups++;
+          this->next_frame_ = now + this->warmup;
+          this->last_move_ = now;
+        }
+
+        if (this->config_mode_ || this->silent || (int32_t) (now - this->next_frame_) < 0)
+          return;
+        this->distance += this->rate * (now - this->last_move_) / 60000.0f;
+        this->last_move_ = now;
+        this->next_frame_ += this->report_cycle;
+        if ((int32_t) (now - this->next_frame_) >= 0)
+          this->next_frame_ = now + this->report_cycle;
+
+        float reading = this->distance;
+        if (this->noise > 0.0f)
+          reading += std::uniform_real_distribution<float>(-this->noise, this->noise)(this->random_);
+        uint8_t value[4];
+        memcpy(value, &reading, 4);
+        send({0xF4, 0xF3, 0xF2, 0xF1}, {value[0], value[1], value[2], value[3]}, {0xF8, 0xF7, 0xF6, 0xF5}, 0);
+        this->frames_sent++;
+      }
+
+    protected:
+      uart::UARTComponent *uart_;
+      std::mt19937 random_;
+      std::vector<uint8_t> request_;
+      bool was_powered_{false};
+      bool config_mode_{false};
+      uint32_t next_frame_{0};
+      uint32_t last_move_{0};
+
+      void on_transmit(const uint8_t *data, size_t len)
+      {
+        if (!is_powered())
+          return;
+        this->request_.insert(this->request_.end(), data, data + len);
+        while (this->request_.size() >= FRAME_OVERHEAD + 2)
+        {
+          if (load_word(this->request_.data()) != ACK_HEADER_WORD)
+          {
+            this->request_.erase(this->request_.begin());
+            continue;
+          }
+          size_t size = FRAME_OVERHEAD + load_half_word(this->request_.data() + FRAME_LENGTH_OFFSET);
+          if (this->request_.size() < size)
+            return;
+          std::vector<uint8_t> frame(this->request_.begin(), this->request_.begin() + size);
+          this->request_.erase(this->request_.begin(), this->request_.begin() + size);
+          if (load_word(&frame[size - 4]) == ACK_FOOTER_WORD)
+            handle_command(load_half_word(&frame[FRAME_DATA_OFFSET]), &frame[FRAME_DATA_OFFSET + 2], size - FRAME_OVERHEAD - 2);
+        }
+      }
+
+      void handle_command(uint16_t command, const uint8_t *data, size_t length)
+      {
+        this->commands.push_back(command);
+        uint16_t echo = command | ACK_COMMAND_FLAG;
+        std::vector<uint8_t> payload{(uint8_t) (echo & 0xFF), (uint8_t) (echo >> 8)};
+
+        if (command == CMD_READ_FIRMWARE_VERSION)
+        {
+          payload.insert(payload.end(), {1, 0, 2, 0, 3, 0});
+        }
+        else if (command == CMD_READ_REPORT_CYCLE)
+        {
+          payload.insert(payload.end(), {(uint8_t) (this->report_cycle & 0xFF), (uint8_t) (this->report_cycle >> 8), 0, 0});
+        }
+        else if (command == this->refused_command)
+        {
+          payload.insert(payload.end(), {1, 0});
+        }
+        else if (this->failing_commands > 0)
+        {
+          this->failing_commands--;
+          payload.insert(payload.end(), {1, 0});
+        }
+        else
+        {
+          payload.insert(payload.end(), {0, 0});
+          if (command == CMD_ENTER_CONFIG_MODE)
+            this->config_mode_ = true;
+          else if (command == CMD_EXIT_CONFIG_MODE)
+            this->config_mode_ = false;
+          else if (command == CMD_SET_REPORT_CYCLE && length >= 2)
+            this->report_cycle = load_half_word(data);
+        }
+        send({0xFD, 0xFC, 0xFB, 0xFA}, payload, {0x04, 0x03, 0x02, 0x01}, this->latency);
+      }
+
+      void send(std::vector<uint8_t> frame, const std::vector<uint8_t> &payload, const std::vector<uint8_t> &footer, uint32_t delay)
+      {
+        frame.push_back(payload.size() & 0xFF);
+        frame.push_back(payload.size() >> 8);
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        frame.insert(frame.end(), footer.begin(), footer.end());
+        this->uart_->receive_at(host::now() + delay, frame.data(), frame.size());
+      }
+    };
+
+  } // namespace hlk_ld2413
+} // namespace esphome
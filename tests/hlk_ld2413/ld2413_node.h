@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include "host.h"
+#include "hlk_ld2413/hlk_ld2413.h"
+#include "ld2413_emulator.h"
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    // The component with its state opened up to the tests
+    class TestSensor : public HLKLD2413Sensor
+    {
+    public:
+      using HLKLD2413Sensor::active_report_cycle_;
+      using HLKLD2413Sensor::calibrating_;
+      using HLKLD2413Sensor::command_count_;
+      using HLKLD2413Sensor::duty_state_;
+      using HLKLD2413Sensor::queue_command;
+      using HLKLD2413Sensor::sample_count_;
+      using HLKLD2413Sensor::sampling_since_;
+      using HLKLD2413Sensor::setup_state_;
+    };
+
+    // One sensor on its UART with the emulated LD2413 at the other end.
+    // Publishes are recorded with the simulated time they happened at.
+    struct Node
+    {
+      struct Reading
+      {
+        uint64_t time; // us
+        float value;
+      };
+
+      uart::UARTComponent uart;
+      TestSensor sensor;
+      LD2413Emulator device;
+      GPIOPin power_pin;
+      std::vector<Reading> distances;
+
+      explicit Node(uint32_t seed = 1) : device(&this->uart, seed)
+      {
+        this->sensor.set_uart_parent(&this->uart);
+        this->sensor.set_update_interval(1000);
+        this->sensor.add_on_state_callback([this](float value)
+                                           { this->distances.push_back({host::now(), value}); });
+        host::register_component(&this->device);
+        host::register_component(&this->sensor);
+      }
+
+      // Duty-cycle mode, the sensor only powered through the pin
+      void with_power_pin(uint8_t frames_per_sample)
+      {
+        this->sensor.set_power_pin(&this->power_pin);
+        this->sensor.set_frames_per_sample(frames_per_sample);
+        this->device.power_pin = &this->power_pin;
+      }
+
+      // Sets up and runs until the boot sequence is through, false if it isn't within 10s
+      bool start()
+      {
+        host::setup();
+        return host::run_until([this]()
+                               { return this->sensor.setup_state_ == SETUP_DONE && this->sensor.command_count_ == 0; },
+                               10000000);
+      }
+    };
+
+  } // namespace hlk_ld2413
+} // namespace esphome
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "hlk_ld2413/hlk_ld2413.h"
+
+namespace esphome
+{
+  namespace hlk_ld2413
+  {
+
+    // One UART read from a capture
+    struct CaptureRecord
+    {
+      uint32_t time; // ms since the capture started
+      std::vector<uint8_t> data;
+    };
+
+    // Decodes an LDC1 capture (see capture.h). Returns false if it's malformed;
+    // records up to the damage are kept.
+    inline bool parse_capture(const std::vector<uint8_t> &capture, std::vector<CaptureRecord> &records)
+    {
+      if (capture.size() < CaptureBuffer::HEADER_SIZE || std::string(capture.begin(), capture.begin() + 4) != "LDC1")
+        return false;
+
+      size_t pos = CaptureBuffer::HEADER_SIZE;
+      auto read_varint = [&capture, &pos](uint32_t &value)
+      {
+        value = 0;
+        for (int shift = 0; shift < 35; shift += 7)
+        {
+          if (pos >= capture.size())
+            return false;
+          uint8_t byte = capture[pos++];
+          value |= (uint32_t) (byte & 0x7F) << shift;
+          if ((byte & 0x80) == 0)
+            return true;
+        }
+        return false;
+      };
+
+      uint32_t time = 0;
+      while (pos < capture.size())
+      {
+        uint32_t delta, length;
+        if (!read_varint(delta) || !read_varint(length) || capture.size() - pos < length)
+          return false;
+        time += delta;
+        records.push_back({time, std::vector<uint8_t>(capture.begin() + pos, capture.begin() + pos + length)});
+        pos += length;
+      }
+      return true;
+    }
+
+    // Turns the text of a capture back into its bytes: either the device log
+    // around dump_capture(), from which the hex after each "capture:" is taken,
+    // or plain hex like `xxd -p` writes. Binary captures pass through as they are.
+    inline std::vector<uint8_t> capture_from_text(const std::string &text)
+    {
+      if (text.compare(0, 4, "LDC1") == 0)
+        return std::vector<uint8_t>(text.begin(), text.end());
+
+      static const char *const MARKER = "capture: ";
+      bool from_log = text.find(MARKER) != std::string::npos;
+      std::string hex;
+      size_t line_start = 0;
+      while (line_start < text.size())
+      {
+        size_t line_end = text.find('\n', line_start);
+        if (line_end == std::string::npos)
+          line_end = text.size();
+        std::string line = text.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+
+        size_t start = 0;
+        if (from_log)
+        {
+          start = line.find(MARKER);
+          if (start == std::string::npos)
+            continue;
+          start += strlen(MARKER);
+        }
+        for (size_t i = start; i < line.size() && !(from_log && line[i] == '\x1b'); i++)
+        {
+          if (isxdigit((unsigned char) line[i]))
+            hex += line[i];
+        }
+      }
+
+      std::vector<uint8_t> capture;
+      for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        capture.push_back(std::stoi(hex.substr(i, 2), nullptr, 16));
+      return capture;
+    }
+
+    // The component with its parser and counters opened up for replay
+    class ReplaySensor : public HLKLD2413Sensor
+    {
+    public:
+      using HLKLD2413Sensor::bad_footers_;
+      using HLKLD2413Sensor::bytes_discarded_;
+      using HLKLD2413Sensor::frames_decoded;
+      using HLKLD2413Sensor::frames_received_;
+      using HLKLD2413Sensor::length_mismatches_;
+      using HLKLD2413Sensor::out_of_range_;
+      using HLKLD2413Sensor::process_buffer;
+      using HLKLD2413Sensor::resyncs_;
+    };
+
+    struct ReplayResult
+    {
+      size_t records{0};
+      size_t bytes{0};
+      uint32_t duration{0};    // ms
+      uint32_t headers{0};     // Data frame headers in the stream
+      uint32_t decoded{0};     // Frames the parser accepted, in range or not
+      uint32_t lost{0};        // Headers that didn't make a frame
+      uint32_t missing{0};     // Frames the report cycle says should have been there, but weren't decoded
+      uint32_t report_cycle{0}; // ms, median time between single frames
+      uint32_t out_of_range{0};
+      uint32_t resyncs{0};
+      uint32_t bad_footers{0};
+      uint32_t length_mismatches{0};
+      uint32_t bytes_discarded{0};
+      double parse_time{0};     // ns per decoded frame, host wall time
+      double max_call_time{0};  // ns, slowest process_buffer() call
+    };
+
+    // Feeds each record to the component through the stub UART at its
+    // recorded time, then runs process_buffer() once, as loop() did when the
+    // bytes were read on the device.
+    inline ReplayResult replay(const std::vector<CaptureRecord> &records, uint16_t min_distance = 0, uint16_t max_distance = 65535)
+    {
+      uart::UARTComponent uart;
+      ReplaySensor sensor;
+      sensor.set_uart_parent(&uart);
+      sensor.set_min_distance(min_distance);
+      sensor.set_max_distance(max_distance);
+      sensor.setup();
+
+      ReplayResult result;
+      result.records = records.size();
+      uint64_t start = host::now();
+      std::vector<uint8_t> stream;
+      std::vector<uint32_t> intervals;
+      uint32_t last_frame_time = 0;
+      bool have_frame = false;
+      std::chrono::duration<double, std::nano> total{0};
+      for (const CaptureRecord &record : records)
+      {
+        host::advance(start + (uint64_t) record.time * 1000 - host::now());
+        uart.receive_at(host::now(), record.data.data(), record.data.size());
+        stream.insert(stream.end(), record.data.begin(), record.data.end());
+
+        uint32_t frames_before = sensor.frames_decoded();
+        auto call_start = std::chrono::steady_clock::now();
+        sensor.process_buffer(false);
+        std::chrono::duration<double, std::nano> call = std::chrono::steady_clock::now() - call_start;
+        total += call;
+        result.max_call_time = std::max(result.max_call_time, call.count());
+
+        uint32_t frames = sensor.frames_decoded() - frames_before;
+        if (frames > 0)
+        {
+          if (have_frame && frames == 1)
+            intervals.push_back(record.time - last_frame_time);
+          last_frame_time = record.time;
+          have_frame = true;
+        }
+        result.bytes += record.data.size();
+      }
+
+      result.duration = records.empty() ? 0 : records.back().time;
+      for (size_t i = 0; i + 4 <= stream.size(); i++)
+        result.headers += load_word(&stream[i]) == DATA_HEADER_WORD;
+      result.decoded = sensor.frames_decoded();
+      result.lost = result.headers > result.decoded ? result.headers - result.decoded : 0;
+      if (!intervals.empty())
+      {
+        std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2, intervals.end());
+        result.report_cycle = intervals[intervals.size() / 2];
+      }
+      if (result.report_cycle > 0)
+      {
+        uint32_t expected = result.duration / result.report_cycle + 1;
+        result.missing = expected > result.decoded ? expected - result.decoded : 0;
+      }
+      result.out_of_range = sensor.out_of_range_;
+      result.resyncs = sensor.resyncs_;
+      result.bad_footers = sensor.bad_footers_;
+      result.length_mismatches = sensor.length_mismatches_;
+      result.bytes_discarded = sensor.bytes_discarded_;
+      result.parse_time = result.decoded > 0 ? total.count() / result.decoded : 0;
+      return result;
+    }
+
+  } // namespace hlk_ld2413
+} // namespace esphome
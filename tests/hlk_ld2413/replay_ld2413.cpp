@@ -0,0 +1,86 @@
+// Replays a capture taken with hlk_ld2413.start_capture / dump_capture
+// through the component's parser on the host, and reports what it made of it.
+//
+//   replay_ld2413 [--min-distance mm] [--max-distance mm] capture...
+//
+// A capture is the binary LDC1 file, plain hex, or the device log around
+// dump_capture() as it is.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include "replay.h"
+
+using namespace esphome;
+using namespace esphome::hlk_ld2413;
+
+static void print_result(const char *name, const ReplayResult &result)
+{
+  printf("%s\n", name);
+  printf("  Records:            %zu (%zu bytes over %.1f s)\n", result.records, result.bytes, result.duration / 1000.0);
+  printf("  Frames decoded:     %u (%u out of range)\n", (unsigned) result.decoded, (unsigned) result.out_of_range);
+  printf("  Frames lost:        %u of %u headers seen\n", (unsigned) result.lost, (unsigned) result.headers);
+  if (result.report_cycle > 0)
+  {
+    printf("  Missing by timing:  %u at a %u ms report cycle\n", (unsigned) result.missing, (unsigned) result.report_cycle);
+  }
+  printf("  Resyncs:            %u\n", (unsigned) result.resyncs);
+  printf("  Bad footers:        %u\n", (unsigned) result.bad_footers);
+  printf("  Length mismatches:  %u\n", (unsigned) result.length_mismatches);
+  printf("  Bytes discarded:    %u\n", (unsigned) result.bytes_discarded);
+  printf("  Parse time:         %.0f ns per frame, slowest call %.0f ns\n", result.parse_time, result.max_call_time);
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t min_distance = 0;
+  uint16_t max_distance = 65535;
+  int files = 0;
+  int failed = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--min-distance") == 0 && i + 1 < argc)
+    {
+      min_distance = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--max-distance") == 0 && i + 1 < argc)
+    {
+      max_distance = atoi(argv[++i]);
+      continue;
+    }
+
+    files++;
+    std::ifstream file(argv[i], std::ios::binary);
+    if (!file)
+    {
+      fprintf(stderr, "%s: can't open\n", argv[i]);
+      failed++;
+      continue;
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<CaptureRecord> records;
+    if (!parse_capture(capture_from_text(text), records))
+    {
+      fprintf(stderr, "%s: not an LDC1 capture, or cut short after %zu records\n", argv[i], records.size());
+      failed++;
+      if (records.empty())
+        continue;
+    }
+
+    host::reset();
+    print_result(argv[i], replay(records, min_distance, max_distance));
+  }
+
+  if (files == 0)
+  {
+    fprintf(stderr, "usage: %s [--min-distance mm] [--max-distance mm] capture...\n", argv[0]);
+    return 2;
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "testing.h"
+#include "ld2413_node.h"
+#include "replay.h"
+
+using namespace esphome;
+using namespace esphome::hlk_ld2413;
+
+static const uint32_t REPORT_CYCLE = 160; // ms
+
+static std::vector<uint8_t> data_frame(float distance)
+{
+  std::vector<uint8_t> frame{0xF4, 0xF3, 0xF2, 0xF1, 0x04, 0x00};
+  uint8_t value[4];
+  memcpy(value, &distance, 4);
+  frame.insert(frame.end(), value, value + 4);
+  frame.insert(frame.end(), {0xF8, 0xF7, 0xF6, 0xF5});
+  return frame;
+}
+
+// A minute of frames with the usual damage mixed in, recorded by the
+// component's own capture and pulled back out of its log
+struct Recording
+{
+  std::vector<CaptureRecord> records;
+  uint32_t frames{0};
+  uint32_t good{0};
+  uint32_t broken{0};
+  uint32_t out_of_range{0};
+  uint32_t reads{0};
+  ReplayResult recorded; // What the recording sensor made of it
+  uint32_t received{0};  // Its frames_received counter
+
+  Recording()
+  {
+    uart::UARTComponent uart;
+    ReplaySensor sensor;
+    sensor.set_uart_parent(&uart);
+    sensor.set_capture_size(16384);
+    sensor.setup();
+    sensor.start_capture();
+
+    for (uint32_t i = 0; i < 60000 / REPORT_CYCLE; i++)
+    {
+      host::advance(REPORT_CYCLE * 1000);
+      bool out_of_range = i % 97 == 50;
+      std::vector<uint8_t> frame = data_frame(out_of_range ? 20000.0f : 1500.0f + i % 20);
+      this->frames++;
+      if (i % 37 == 10)
+      {
+        frame[11] ^= 0xFF; // Footer
+        this->broken++;
+      }
+      else if (i % 71 == 20)
+      {
+        frame.resize(8); // Cut short
+        this->broken++;
+      }
+      else if (out_of_range)
+      {
+        this->out_of_range++;
+      }
+      else
+      {
+        this->good++;
+      }
+      if (i % 53 == 30)
+        frame.insert(frame.end(), 5, 0x00); // Noise after the frame
+
+      // Every fifth frame arrives in two reads
+      size_t split = i % 5 == 0 ? 6 : frame.size();
+      for (size_t start = 0; start < frame.size(); start = split, split = frame.size())
+      {
+        uart.receive_at(host::now(), frame.data() + start, split - start);
+        sensor.process_buffer(false);
+        this->reads++;
+        host::advance(1000);
+      }
+    }
+
+    sensor.stop_capture();
+    host::clear_log();
+    sensor.dump_capture();
+    std::string log;
+    for (auto &line : host::find_log(""))
+      log += "[I][hlk_ld2413:123]: " + line + "\n";
+    parse_capture(capture_from_text(log), this->records);
+
+    this->recorded.decoded = sensor.frames_decoded();
+    this->received = sensor.frames_received_;
+    this->recorded.resyncs = sensor.resyncs_;
+    this->recorded.bad_footers = sensor.bad_footers_;
+    this->recorded.length_mismatches = sensor.length_mismatches_;
+    this->recorded.bytes_discarded = sensor.bytes_discarded_;
+  }
+};
+
+TEST(replay_matches_device)
+{
+  Recording recording;
+  EXPECT(recording.records.size() == recording.reads);
+
+  host::reset();
+  ReplayResult result = replay(recording.records, 250, 10000);
+  EXPECT(result.decoded == recording.recorded.decoded);
+  EXPECT(result.resyncs == recording.recorded.resyncs);
+  EXPECT(result.bad_footers == recording.recorded.bad_footers);
+  EXPECT(result.length_mismatches == recording.recorded.length_mismatches);
+  EXPECT(result.bytes_discarded == recording.recorded.bytes_discarded);
+
+  EXPECT(recording.received == recording.good);
+  EXPECT(result.decoded == recording.good + recording.out_of_range);
+  EXPECT(result.out_of_range == recording.out_of_range);
+  EXPECT(result.headers == recording.frames);
+  EXPECT(result.lost == recording.broken);
+  EXPECT(result.report_cycle >= REPORT_CYCLE && result.report_cycle <= REPORT_CYCLE + 2);
+  EXPECT(result.missing >= recording.broken - 1 && result.missing <= recording.broken + 1);
+  EXPECT(result.resyncs > 0);
+  EXPECT(result.parse_time > 0);
+}
+
+TEST(capture_formats)
+{
+  std::vector<uint8_t> capture{'L', 'D', 'C', '1', 0, 0, 0, 0, 0x05, 0x02, 0xAA, 0xBB, 0x81, 0x01, 0x01, 0xCC};
+  std::vector<CaptureRecord> records;
+  EXPECT(parse_capture(capture, records));
+  EXPECT(records.size() == 2);
+  EXPECT(records[0].time == 5 && records[0].data.size() == 2 && records[0].data[1] == 0xBB);
+  EXPECT(records[1].time == 5 + 129 && records[1].data.size() == 1 && records[1].data[0] == 0xCC);
+
+  // The same as plain hex, and as a binary file read as text
+  EXPECT(capture_from_text("4C444331000000\n0005 02AABB 810101CC\n") == capture);
+  EXPECT(capture_from_text(std::string(capture.begin(), capture.end())) == capture);
+
+  // A record cut short keeps the ones before it
+  capture.pop_back();
+  records.clear();
+  EXPECT(!parse_capture(capture, records));
+  EXPECT(records.size() == 1);
+  EXPECT(!parse_capture({'L', 'D', 'C', '2', 0, 0, 0, 0}, records));
+}
+
+TEST(adaptive_report_cycle)
+{
+  Node node;
+  node.sensor.set_update_interval(60000);
+  node.sensor.set_report_cycle(1000);
+  node.sensor.set_adaptive_report_cycle(50, 1000, 30.0f, 10.0f, 60000);
+  node.device.noise = 3.0f;
+  host::set_loop_time(1000);
+  EXPECT(node.start());
+
+  // Noise alone doesn't look like a fill
+  host::run_for(600000000);
+  EXPECT(host::count_log("switching report cycle") == 0);
+  EXPECT(node.device.report_cycle == 1000);
+
+  // A 120 mm/min fill is caught within about one rate window, well before the
+  // next update
+  uint64_t fill_start = host::now();
+  node.device.rate = -120.0f;
+  EXPECT(host::run_until([&node]()
+                         { return node.device.report_cycle == 50; },
+                         60000000));
+  EXPECT(host::now() - fill_start < 12000000);
+
+  // Back to the slow cycle once the level has been steady for the steady time
+  node.device.rate = 0.0f;
+  uint64_t fill_end = host::now();
+  EXPECT(host::run_until([&node]()
+                         { return node.device.report_cycle == 1000; },
+                         120000000));
+  EXPECT(host::now() - fill_end > 60000000 && host::now() - fill_end < 90000000);
+}
+
+TEST(adaptive_report_cycle_refused)
+{
+  Node node;
+  node.sensor.set_update_interval(60000);
+  node.sensor.set_report_cycle(1000);
+  node.sensor.set_adaptive_report_cycle(50, 1000, 30.0f, 10.0f, 60000);
+  host::set_loop_time(1000);
+  EXPECT(node.start());
+
+  // A sensor that refuses the fast cycle is asked again after 10s, 20s, 40s...
+  // rather than on every frame
+  node.device.refused_command = CMD_SET_REPORT_CYCLE;
+  node.device.rate = -120.0f;
+  host::run_for(90000000);
+  size_t refused = host::count_log("Report cycle change to 50 ms failed");
+  EXPECT(refused >= 3 && refused <= 4);
+  EXPECT(std::count(node.device.commands.begin(), node.device.commands.end(), CMD_SET_REPORT_CYCLE) <= 5 * 4 + 1);
+  EXPECT(host::count_log("not retrying for 40 s") == 1);
+  EXPECT(node.sensor.active_report_cycle_ == 1000);
+
+  // Once it takes the change the backoff starts over
+  node.device.refused_command = 0xFFFF;
+  EXPECT(host::run_until([&node]()
+                         { return node.device.report_cycle == 50; },
+                         90000000));
+  node.device.refused_command = CMD_SET_REPORT_CYCLE;
+  node.device.rate = 0.0f;
+  host::clear_log();
+  EXPECT(host::run_until([]()
+                         { return host::count_log("Report cycle change to 1000 ms failed") > 0; },
+                         120000000));
+  EXPECT(host::count_log("not retrying for 10 s") == 1);
+}
+
+TEST(command_queue_limits)
+{
+  Node node;
+  EXPECT(node.start());
+
+  // Too much data is its own error, not a full queue
+  uint8_t data[64] = {0};
+  EXPECT(!node.sensor.queue_command(CMD_SET_REPORT_CYCLE, data, sizeof(data), "oversized command"));
+  EXPECT(host::count_log("oversized command has 64 bytes of data") == 1);
+  EXPECT(host::count_log("Command queue full") == 0);
+  EXPECT(node.sensor.command_count_ == 0);
+
+  while (node.sensor.queue_command(CMD_READ_REPORT_CYCLE, nullptr, 0, "read reporting cycle"))
+    ;
+  EXPECT(host::count_log("Command queue full, dropping read reporting cycle") == 1);
+}
+
+TEST(duty_cycle_calibration)
+{
+  Node node;
+  node.with_power_pin(3);
+  node.sensor.set_update_interval(60000);
+  node.sensor.set_calibrate_on_boot(true);
+  EXPECT(node.start());
+  EXPECT(!node.power_pin.digital_read());
+
+  // The calibration runs while the sensor is up for the first sample. The frame
+  // that woke it up counts, and the sample is published once it's done.
+  uint32_t frames_before = node.device.frames_sent;
+  EXPECT(host::run_until([&node]()
+                         { return !node.distances.empty(); },
+                         70000000));
+  EXPECT(std::count(node.device.commands.begin(), node.device.commands.end(), CMD_UPDATE_THRESHOLD) == 1);
+  EXPECT(node.device.frames_sent - frames_before == 3);
+  EXPECT(node.device.power_ups == 2);
+  EXPECT(!node.power_pin.digital_read());
+  EXPECT(host::count_log("median of 3 frames") == 1);
+  EXPECT(host::count_log("", 2) == 0);
+}
+
+TEST(duty_cycle_empty_window)
+{
+  Node node;
+  node.with_power_pin(3);
+  node.sensor.set_update_interval(60000);
+  EXPECT(node.start());
+
+  // Up and sampling, but the frames stop
+  node.power_pin.digital_write(true);
+  node.sensor.duty_state_ = DUTY_SAMPLING;
+  node.sensor.sample_count_ = 0;
+  node.sensor.sampling_since_ = millis();
+  node.device.silent = true;
+  host::run_for(3000000);
+  EXPECT(node.power_pin.digital_read());
+
+  // The first empty window keeps the sensor powered, the second gives up
+  host::run_for(1000000);
+  EXPECT(host::count_log("keeping the sensor powered for another") == 1);
+  EXPECT(node.power_pin.digital_read());
+  host::run_for(4000000);
+  EXPECT(host::count_log("powering down without a sample") == 1);
+  EXPECT(!node.power_pin.digital_read());
+  EXPECT(node.distances.empty());
+
+  // The next update samples as usual
+  node.device.silent = false;
+  EXPECT(host::run_until([&node]()
+                         { return !node.distances.empty(); },
+                         70000000));
+  EXPECT(host::count_log("median of 3 frames") == 1);
+}
+
+TEST(duty_cycle_learned_warmup)
+{
+  Node node;
+  node.with_power_pin(3);
+  node.sensor.set_update_interval(60000);
+  EXPECT(node.start());
+  EXPECT(host::run_until([&node]()
+                         { return !node.distances.empty(); },
+                         70000000));
+  EXPECT(host::count_log("learned warm-up 3") >= 1);
+
+  // Once the warm-up is known a sensor that doesn't come up is given up on
+  // well before the warm-up timeout
+  node.device.silent = true;
+  EXPECT(host::run_until([&node]()
+                         { return node.power_pin.digital_read(); },
+                         70000000));
+  uint64_t power_up = host::now();
+  EXPECT(host::run_until([&node]()
+                         { return !node.power_pin.digital_read(); },
+                         10000000));
+  EXPECT(host::now() - power_up < 1000000);
+  EXPECT(host::count_log("No valid frame within", 2) == 1);
+
+  // The next warm-ups get the full timeout, in case the sensor just got slower
+  EXPECT(host::run_until([&node]()
+                         { return node.power_pin.digital_read(); },
+                         70000000));
+  power_up = host::now();
+  EXPECT(host::run_until([&node]()
+                         { return !node.power_pin.digital_read(); },
+                         10000000));
+  EXPECT(host::now() - power_up > 5000000);
+
+  // One that now takes 1.5s is sampled and its warm-up learned again
+  node.device.silent = false;
+  node.device.warmup = 1500;
+  size_t published = node.distances.size();
+  EXPECT(host::run_until([&node, published]()
+                         { return node.distances.size() > published; },
+                         70000000));
+  EXPECT(host::count_log("No valid frame within", 2) == 2);
+  EXPECT(host::count_log("First frame 15") == 1);
+}
+
+TEST(publish_on_change)
+{
+  Node node;
+  node.sensor.set_update_interval(600000);
+  node.sensor.set_publish_on_change(5.0f, 1000, 0);
+  node.device.report_cycle = 50;
+  EXPECT(node.start());
+  EXPECT(host::run_until([&node]()
+                         { return !node.distances.empty(); },
+                         2000000));
+  host::run_for(2000000);
+  EXPECT(node.distances.size() == 1);
+
+  // A step is published at once
+  node.device.distance = 1510.0f;
+  EXPECT(host::run_until([&node]()
+                         { return node.distances.size() == 2; },
+                         1000000));
+  EXPECT(node.distances.back().value == 1510.0f);
+
+  // A spike inside min_interval that settles back within the threshold is dropped
+  host::run_for(100000);
+  node.device.distance = 1520.0f;
+  host::run_for(300000);
+  node.device.distance = 1512.0f;
+  host::run_for(2000000);
+  EXPECT(node.distances.size() == 2);
+
+  // One that doesn't settle back is published with the newest value
+  node.device.distance = 1530.0f;
+  host::run_for(100000);
+  node.device.distance = 1540.0f;
+  host::run_for(300000);
+  node.device.distance = 1522.0f;
+  host::run_for(2000000);
+  EXPECT(node.distances.size() == 4);
+  EXPECT(node.distances.back().value == 1522.0f);
+}
+
+int main(int argc, char **argv) { return testing::run_tests(argc, argv); }
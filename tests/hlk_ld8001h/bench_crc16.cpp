@@ -0,0 +1,55 @@
+// Speed of the CRC16/MODBUS variants in crc16.h, on the host. The ratio
+// between them is what carries over to the ESP, not the absolute figures.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "hlk_ld8001h/crc16.h"
+
+using namespace esphome::hlk_ld8001h;
+
+static uint16_t crc16_bitwise(const uint8_t *data, size_t length, uint16_t crc = CRC16_MODBUS_INIT)
+{
+	for (size_t i = 0; i < length; i++)
+		crc = crc16_modbus_bits(crc ^ data[i], 8);
+	return crc;
+}
+
+using CrcFunction = uint16_t (*)(const uint8_t *, size_t, uint16_t);
+
+// ns per byte over many frames of a given size
+static double measure(CrcFunction crc, const std::vector<uint8_t> &data, size_t frame)
+{
+	const int rounds = 200;
+	volatile uint16_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (size_t offset = 0; offset + frame <= data.size(); offset += frame)
+			sink = sink ^ crc(data.data() + offset, frame, CRC16_MODBUS_INIT);
+	}
+	auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return elapsed / ((double) rounds * (data.size() / frame) * frame);
+}
+
+int main()
+{
+	std::mt19937 random(1);
+	std::vector<uint8_t> data(64 * 1024);
+	for (auto &byte : data)
+		byte = random();
+
+	printf("CRC16/MODBUS, ns per byte\n");
+	printf("| Frame | Table (512 bytes) | Nibble table (32 bytes) | Bitwise |\n");
+	// A request, a block read answer, and a long run of bytes
+	for (size_t frame : {(size_t) 6, (size_t) 9, (size_t) 4096})
+	{
+		double table = measure(crc16_modbus_table, data, frame);
+		double nibble = measure(crc16_modbus_nibble, data, frame);
+		double bitwise = measure(crc16_bitwise, data, frame);
+		printf("| %zu bytes | %.2f | %.2f (%.1fx) | %.2f (%.1fx) |\n", frame, table, nibble, nibble / table, bitwise,
+			   bitwise / table);
+	}
+	return 0;
+}
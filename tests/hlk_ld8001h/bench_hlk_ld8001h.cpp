@@ -0,0 +1,233 @@
+// Bus timing of the LD8001H component against the emulated sensor, in
+// simulated time: transactions per second, time per update and recovery from
+// a bad line or a sensor that stops answering. The emulated sensor answers
+// 1ms after a request and the main loop makes a pass every 100us, like a
+// node with little else to do.
+
+#include <algorithm>
+#include <cstdio>
+#include "ld8001h_node.h"
+
+using namespace esphome;
+using namespace esphome::hlk_ld8001h;
+
+static const uint64_t SECOND = 1000000; // us
+static const uint32_t BAUD_RATES[] = {9600, 19200, 115200};
+
+// Requests through the master alone, without a sensor component
+struct Line
+{
+	uart::UARTComponent uart;
+	uart::UARTDevice device{&uart};
+	LD8001HEmulator sensor;
+	ModbusMaster master;
+
+	explicit Line(uint32_t baud_rate) : sensor(&uart)
+	{
+		this->uart.set_baud_rate(baud_rate);
+		this->sensor.registers[BaudRateRegister::ADDRESS] = BaudRateRegister::to_raw(baud_rate);
+		this->master.set_uart(&this->device);
+		this->master.set_baud_rate(baud_rate);
+	}
+
+	// Back to back reads for a while, transactions per second
+	double throughput(uint8_t count, uint64_t duration)
+	{
+		uint32_t done = 0;
+		uint64_t end = host::now() + duration;
+		while (host::now() < end)
+		{
+			if (this->master.is_idle())
+				this->master.read_registers(1, SpaceHeightRegister::ADDRESS, count, [&done](const ModbusResponse &response)
+											{ done += response.result == MODBUS_OK; });
+			this->master.loop();
+			host::loop_once();
+		}
+		return done * (double) SECOND / duration;
+	}
+
+	// Time until one request is given up on (us)
+	uint64_t failure_time(uint8_t attempts)
+	{
+		bool finished = false;
+		uint64_t start = host::now();
+		this->master.read_registers(1, SpaceHeightRegister::ADDRESS, 1, [&finished](const ModbusResponse &response)
+									{ finished = true; },
+									attempts);
+		while (!finished)
+		{
+			this->master.loop();
+			host::loop_once();
+		}
+		return host::now() - start;
+	}
+};
+
+static double ms(uint64_t us) { return us / 1000.0; }
+
+static void bench_throughput()
+{
+	printf("Transactions per second, back to back\n");
+	printf("| | %9s | %9s | %9s |\n", "9600", "19200", "115200");
+	for (uint8_t count : {(uint8_t) 1, MeasurementBlock::COUNT})
+	{
+		printf("| %u register%s |", count, count == 1 ? " " : "s");
+		for (uint32_t baud_rate : BAUD_RATES)
+		{
+			host::reset();
+			Line line(baud_rate);
+			printf(" %7.1f/s |", line.throughput(count, 10 * SECOND));
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+// Mean time from update() until the readings are published
+static double update_time(uint32_t baud_rate, bool depth, uint8_t burst)
+{
+	host::reset();
+	Node node(baud_rate);
+	node.sensor.set_update_interval(3600000);
+	if (depth)
+		node.with_depth();
+	if (burst > 1)
+		node.sensor.set_burst(burst, BURST_MEDIAN);
+	node.start();
+
+	uint64_t total = 0;
+	const int reads = 20;
+	for (int i = 0; i < reads; i++)
+	{
+		total += node.read_once();
+		host::run_for(10000);
+	}
+	return ms(total) / reads;
+}
+
+static void bench_update_time()
+{
+	printf("Time per update, from update() until published\n");
+	printf("| | %9s | %9s | %9s |\n", "9600", "19200", "115200");
+	struct
+	{
+		const char *name;
+		bool depth;
+		uint8_t burst;
+	} cases[] = {
+		{"Distance only, one read", false, 1},
+		{"Distance and depth, block read", true, 1},
+		{"Distance and depth, burst of 7", true, 7},
+	};
+	for (auto &c : cases)
+	{
+		printf("| %s |", c.name);
+		for (uint32_t baud_rate : BAUD_RATES)
+			printf(" %7.1fms |", update_time(baud_rate, c.depth, c.burst));
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static void bench_no_answer()
+{
+	printf("Sensor not answering, until the request is given up\n");
+	printf("| | %9s | %9s | %9s |\n", "9600", "19200", "115200");
+	for (uint8_t attempts : {(uint8_t) 1, (uint8_t) 3})
+	{
+		printf("| %u attempt%s |", attempts, attempts == 1 ? " " : "s");
+		for (uint32_t baud_rate : BAUD_RATES)
+		{
+			host::reset();
+			Line line(baud_rate);
+			line.sensor.dead = true;
+			printf(" %7.1fms |", ms(line.failure_time(attempts)));
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static void bench_faulty_link()
+{
+	printf("Bad line at 115200 baud, 10 minutes of updates every second\n");
+	printf("| Faults per answer | Published | Mean update | Slowest update | Retries per request |\n");
+	for (float rate : {0.01f, 0.05f, 0.1f})
+	{
+		host::reset();
+		Node node(115200, 7);
+		node.with_depth();
+		node.sensor.set_update_interval(3600000);
+		node.start();
+		node.device.faults.no_answer = rate;
+		node.device.faults.drop_byte = rate;
+		node.device.faults.corrupt = rate;
+		node.device.faults.split = rate;
+		node.device.faults.split_gap = 3000;
+
+		const int updates = 600;
+		int published = 0;
+		uint64_t total = 0;
+		uint64_t slowest = 0;
+		const ModbusStats &stats = node.sensor.get_link_stats();
+		uint32_t requests = stats.requests;
+		uint32_t retries = stats.retries;
+		for (int i = 0; i < updates; i++)
+		{
+			uint64_t start = host::now();
+			uint64_t time = node.read_once();
+			if (time > 0)
+			{
+				published++;
+				total += time;
+				slowest = std::max(slowest, time);
+			}
+			host::run_until([&]()
+							{ return node.bus_idle(); },
+							SECOND);
+			host::run_for(SECOND - std::min<uint64_t>(host::now() - start, SECOND - 1));
+		}
+		printf("| %.0f%% of each kind | %5.1f%% | %.1fms | %.1fms | %.2f |\n", rate * 100, 100.0 * published / updates,
+			   ms(total) / std::max(published, 1), ms(slowest),
+			   (double) (stats.retries - retries) / std::max<uint32_t>(stats.requests - requests, 1));
+	}
+	printf("\n");
+}
+
+static void bench_outage()
+{
+	printf("Sensor gone, then back, updates every second at 115200 baud\n");
+	printf("| Outage | Requests while gone | Back to first reading |\n");
+	for (uint64_t outage : {10 * SECOND, 60 * SECOND, 300 * SECOND})
+	{
+		host::reset();
+		Node node;
+		node.sensor.set_update_interval(1000);
+		node.start();
+		host::run_for(5 * SECOND);
+
+		node.device.dead = true;
+		uint32_t requests = node.device.requests;
+		host::run_for(outage);
+		requests = node.device.requests - requests;
+
+		node.device.dead = false;
+		size_t before = node.distances.size();
+		uint64_t back = host::now();
+		host::run_until([&]()
+						{ return node.distances.size() > before; },
+						600 * SECOND);
+		printf("| %.0fs | %u | %.1fs |\n", outage / (double) SECOND, (unsigned) requests, (host::now() - back) / (double) SECOND);
+	}
+	printf("\n");
+}
+
+int main()
+{
+	bench_throughput();
+	bench_update_time();
+	bench_no_answer();
+	bench_faulty_link();
+	bench_outage();
+	return 0;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+#include "esphome/components/uart/uart.h"
+#include "host.h"
+#include "hlk_ld8001h/crc16.h"
+#include "hlk_ld8001h/registers.h"
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		// Things that go wrong on a real line, each a chance per answer
+		struct LinkFaults
+		{
+			float no_answer{0.0f};	// The request is lost, nothing comes back
+			float drop_byte{0.0f};	// One byte of the answer is lost
+			float corrupt{0.0f};	// One bit of the answer flips
+			float split{0.0f};		// The answer reaches the UART driver in two chunks
+			uint32_t split_gap{0};	// us between the chunks
+		};
+
+		// An LD8001H at the far end of a host UART. It answers reads and writes of
+		// its registers like the sensor: at its own address and the broadcast
+		// address, only at its own baud rate, with exceptions for registers it
+		// doesn't have. Bytes arrive with 8N1 wire timing after the configured
+		// processing latency, and faults are drawn from a seeded generator so a
+		// run can be repeated.
+		class LD8001HEmulator
+		{
+		public:
+			explicit LD8001HEmulator(uart::UARTComponent *uart, uint8_t address = 1, uint32_t seed = 1) : uart_(uart), random_(seed)
+			{
+				this->registers[SpaceHeightRegister::ADDRESS] = 1000;
+				this->registers[SpaceHeightRegister::ADDRESS + 1] = 0; // Reserved, read as part of the measurement block
+				this->registers[WaterLevelRegister::ADDRESS] = 1000;
+				this->registers[InstallationHeightRegister::ADDRESS] = 200;
+				this->registers[DeviceAddressRegister::ADDRESS] = address;
+				this->registers[BaudRateRegister::ADDRESS] = 1152;
+				this->registers[RangeRegister::ADDRESS] = 10;
+				uart->add_on_transmit_callback([this](const uint8_t *data, size_t len)
+											   { this->on_transmit(data, len); });
+			}
+
+			// Register values, by address
+			std::map<uint16_t, uint16_t> registers;
+			// Time from the end of a request to the first byte of the answer (us)
+			uint32_t latency{1000};
+			LinkFaults faults;
+			bool dead{false};		// Answers nothing
+			uint8_t busy{0};		// Answers this many requests with "device busy"
+
+			// The measured distance, the sensor works out the water level itself
+			void set_distance(uint16_t distance)
+			{
+				this->registers[SpaceHeightRegister::ADDRESS] = distance;
+				uint32_t installation = InstallationHeightRegister::to_value(this->registers[InstallationHeightRegister::ADDRESS]);
+				this->registers[WaterLevelRegister::ADDRESS] = installation > distance ? installation - distance : 0;
+			}
+			// Firmware that refuses the reserved register, and so block reads
+			void disable_block_reads() { this->registers.erase(SpaceHeightRegister::ADDRESS + 1); }
+
+			uint8_t get_address() const { return this->registers.at(DeviceAddressRegister::ADDRESS); }
+			uint32_t get_baud_rate() const { return BaudRateRegister::to_value(this->registers.at(BaudRateRegister::ADDRESS)); }
+
+			// Well-formed requests for this sensor, and what became of them
+			uint32_t requests{0};
+			uint32_t answers{0};
+			uint32_t faults_injected{0};
+
+		protected:
+			static const size_t REQUEST_SIZE = 8;
+			static const uint8_t BITS_PER_CHAR = 10; // 8N1
+
+			uart::UARTComponent *uart_;
+			std::mt19937 random_;
+			std::vector<uint8_t> request_;
+
+			uint32_t char_time() const { return (BITS_PER_CHAR * 1000000 + this->uart_->get_baud_rate() - 1) / this->uart_->get_baud_rate(); }
+
+			bool chance(float probability) { return probability > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(this->random_) < probability; }
+
+			void on_transmit(const uint8_t *data, size_t len)
+			{
+				// At another baud rate the sensor only sees noise
+				if (this->uart_->get_baud_rate() != get_baud_rate())
+					return;
+
+				uint64_t end = host::now() + len * char_time();
+				this->request_.insert(this->request_.end(), data, data + len);
+				while (this->request_.size() >= REQUEST_SIZE)
+				{
+					std::vector<uint8_t> frame(this->request_.begin(), this->request_.begin() + REQUEST_SIZE);
+					this->request_.erase(this->request_.begin(), this->request_.begin() + REQUEST_SIZE);
+					handle_request(frame, end);
+				}
+			}
+
+			void handle_request(const std::vector<uint8_t> &frame, uint64_t end)
+			{
+				uint16_t crc = frame[6] | frame[7] << 8;
+				if (crc16_modbus(frame.data(), 6) != crc)
+					return;
+				uint8_t address = get_address();
+				if (frame[0] != address && frame[0] != MODBUS_BROADCAST_ADDRESS)
+					return;
+				this->requests++;
+				if (this->dead || chance(this->faults.no_answer))
+					return;
+
+				uint8_t function = frame[1];
+				uint16_t reg = frame[2] << 8 | frame[3];
+				uint16_t value = frame[4] << 8 | frame[5];
+				std::vector<uint8_t> answer{address, function};
+
+				if (this->busy > 0)
+				{
+					this->busy--;
+					send_exception(answer, MODBUS_DEVICE_BUSY, end);
+					return;
+				}
+
+				if (function == MODBUS_READ_HOLDING_REGISTERS)
+				{
+					if (value == 0 || value > MAX_READ_REGISTERS)
+					{
+						send_exception(answer, MODBUS_ILLEGAL_DATA_VALUE, end);
+						return;
+					}
+					answer.push_back(2 * value);
+					for (uint16_t i = 0; i < value; i++)
+					{
+						auto it = this->registers.find(reg + i);
+						if (it == this->registers.end())
+						{
+							send_exception(answer, MODBUS_ILLEGAL_DATA_ADDRESS, end);
+							return;
+						}
+						answer.push_back(it->second >> 8);
+						answer.push_back(it->second & 0xFF);
+					}
+					send(answer, end);
+				}
+				else if (function == MODBUS_WRITE_SINGLE_REGISTER)
+				{
+					if (this->registers.count(reg) == 0 || reg == SpaceHeightRegister::ADDRESS || reg == WaterLevelRegister::ADDRESS)
+					{
+						send_exception(answer, MODBUS_ILLEGAL_DATA_ADDRESS, end);
+						return;
+					}
+					// The echo goes out with the old address and rate, the new ones apply after it
+					answer.insert(answer.end(), frame.begin() + 2, frame.begin() + 6);
+					send(answer, end);
+					this->registers[reg] = value;
+				}
+				else
+				{
+					send_exception(answer, MODBUS_ILLEGAL_FUNCTION, end);
+				}
+			}
+
+			void send_exception(std::vector<uint8_t> &answer, uint8_t code, uint64_t end)
+			{
+				answer.resize(2);
+				answer[1] |= MODBUS_EXCEPTION_FLAG;
+				answer.push_back(code);
+				send(answer, end);
+			}
+
+			void send(std::vector<uint8_t> &answer, uint64_t end)
+			{
+				uint16_t crc = crc16_modbus(answer.data(), answer.size());
+				answer.push_back(crc & 0xFF);
+				answer.push_back(crc >> 8);
+				this->answers++;
+
+				if (chance(this->faults.drop_byte))
+				{
+					this->faults_injected++;
+					answer.erase(answer.begin() + this->random_() % answer.size());
+				}
+				if (chance(this->faults.corrupt))
+				{
+					this->faults_injected++;
+					answer[this->random_() % answer.size()] ^= 1 << (this->random_() % 8);
+				}
+				size_t split_at = answer.size();
+				if (chance(this->faults.split))
+				{
+					this->faults_injected++;
+					split_at = 1 + this->random_() % (answer.size() - 1);
+				}
+
+				// The UART driver hands each byte over as its stop bit ends
+				uint64_t time = end + this->latency;
+				for (size_t i = 0; i < answer.size(); i++)
+				{
+					if (i == split_at)
+						time += this->faults.split_gap;
+					time += char_time();
+					this->uart_->receive_at(time, answer[i]);
+				}
+			}
+		};
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
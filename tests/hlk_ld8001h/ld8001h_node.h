@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include "host.h"
+#include "hlk_ld8001h/hlk_ld8001h.h"
+#include "ld8001h_emulator.h"
+
+namespace esphome
+{
+	namespace hlk_ld8001h
+	{
+
+		// The sensor with its state opened up to the tests
+		class TestSensor : public HLKLD8001HSensor
+		{
+		public:
+			using HLKLD8001HSensor::block_reads_;
+			using HLKLD8001HSensor::handle_sample;
+			using HLKLD8001HSensor::reading_;
+			using HLKLD8001HSensor::request_measurement;
+			using HLKLD8001HSensor::samples_taken_;
+			using HLKLD8001HSensor::valid_samples_;
+			using HLKLD8001HSensor::setup_complete_;
+		};
+
+		// One sensor on its own bus, like a node with a single LD8001H, plus the
+		// emulated sensor at the other end of the UART. Publishes are recorded
+		// with the simulated time they happened at.
+		struct Node
+		{
+			struct Reading
+			{
+				uint64_t time; // us
+				float value;
+			};
+
+			uart::UARTComponent uart;
+			ModbusBus bus;
+			TestSensor sensor;
+			sensor::Sensor depth{"water depth"};
+			LD8001HEmulator device;
+			std::vector<Reading> distances;
+			std::vector<Reading> depths;
+
+			explicit Node(uint32_t baud_rate = 115200, uint32_t seed = 1) : device(&uart, 1, seed)
+			{
+				this->uart.set_baud_rate(baud_rate);
+				this->device.registers[BaudRateRegister::ADDRESS] = BaudRateRegister::to_raw(baud_rate);
+				this->bus.set_uart_parent(&this->uart);
+				this->sensor.set_bus(&this->bus);
+				this->bus.register_client(&this->sensor);
+				this->sensor.add_on_state_callback([this](float value)
+												   { this->distances.push_back({host::now(), value}); });
+				this->depth.add_on_state_callback([this](float value)
+												  { this->depths.push_back({host::now(), value}); });
+				host::register_component(&this->bus);
+				host::register_component(&this->sensor);
+			}
+
+			// Water depth from a 2m installation height, which the emulated sensor already has
+			void with_depth()
+			{
+				this->sensor.set_water_depth_sensor(&this->depth);
+				this->sensor.set_has_installation_height(true);
+				this->sensor.set_installation_height(2000);
+			}
+
+			// Set up, and wait for the configuration to go through
+			bool start()
+			{
+				host::setup();
+				return host::run_until([this]()
+									   { return this->sensor.setup_complete_ && this->bus_idle(); },
+									   5000000);
+			}
+
+			bool bus_idle() const { return !this->sensor.has_bus_work() && !this->sensor.reading_; }
+
+			// Take one reading now, outside the poller. Returns how long it took
+			// until everything was published (us), or 0 if nothing was.
+			uint64_t read_once(uint64_t timeout = 2000000)
+			{
+				size_t before = this->distances.size();
+				uint64_t start = host::now();
+				this->sensor.update();
+				bool published = host::run_until([this, before]()
+												 { return this->distances.size() > before && !this->sensor.reading_; },
+												 timeout);
+				return published ? host::now() - start : 0;
+			}
+		};
+
+	} // namespace hlk_ld8001h
+} // namespace esphome
@@ -0,0 +1,54 @@
+#include <random>
+#include <vector>
+#include "testing.h"
+#include "hlk_ld8001h/crc16.h"
+
+using namespace esphome::hlk_ld8001h;
+
+// Reference: the algorithm the tables are generated from, a bit at a time
+static uint16_t crc16_bitwise(const uint8_t *data, size_t length, uint16_t crc = CRC16_MODBUS_INIT)
+{
+	for (size_t i = 0; i < length; i++)
+		crc = crc16_modbus_bits(crc ^ data[i], 8);
+	return crc;
+}
+
+TEST(known_frames)
+{
+	// Read requests from the sensor's documentation, CRC sent low byte first
+	const uint8_t space_height[] = {0x01, 0x03, 0x00, 0x01, 0x00, 0x01};
+	const uint8_t baud_rate[] = {0x01, 0x03, 0x03, 0xF6, 0x00, 0x01};
+	EXPECT(crc16_modbus(space_height, 6) == 0xCAD5);
+	EXPECT(crc16_modbus(baud_rate, 6) == 0x7C64);
+	// CRC-16/MODBUS check value
+	EXPECT(crc16_modbus(reinterpret_cast<const uint8_t *>("123456789"), 9) == 0x4B37);
+	EXPECT(crc16_modbus(nullptr, 0) == CRC16_MODBUS_INIT);
+}
+
+TEST(tables_match_bitwise)
+{
+	std::mt19937 random(12345);
+	std::vector<uint8_t> data;
+	for (int i = 0; i < 100000; i++)
+	{
+		data.resize(random() % 64);
+		for (auto &byte : data)
+			byte = random();
+		uint16_t init = i % 2 == 0 ? CRC16_MODBUS_INIT : (uint16_t) random();
+
+		uint16_t expected = crc16_bitwise(data.data(), data.size(), init);
+		EXPECT(crc16_modbus_table(data.data(), data.size(), init) == expected);
+		EXPECT(crc16_modbus_nibble(data.data(), data.size(), init) == expected);
+	}
+}
+
+// Feeding a frame in pieces gives the same CRC as all at once
+TEST(incremental)
+{
+	const uint8_t frame[] = {0x01, 0x03, 0x06, 0x04, 0xD2, 0x00, 0x00, 0x02, 0xFE};
+	uint16_t whole = crc16_modbus(frame, sizeof(frame));
+	for (size_t split = 0; split <= sizeof(frame); split++)
+		EXPECT(crc16_modbus(frame + split, sizeof(frame) - split, crc16_modbus(frame, split)) == whole);
+}
+
+int main(int argc, char **argv) { return testing::run_tests(argc, argv); }
@@ -0,0 +1,293 @@
+#include <set>
+#include <vector>
+#include "testing.h"
+#include "ld8001h_node.h"
+
+using namespace esphome;
+using namespace esphome::hlk_ld8001h;
+
+static const uint64_t SECOND = 1000000; // us
+
+TEST(configures_and_reads)
+{
+	Node node;
+	node.with_depth();
+	node.sensor.set_range(20000);
+	node.device.registers[InstallationHeightRegister::ADDRESS] = 150;
+	node.device.set_distance(1234);
+
+	EXPECT(node.start());
+	EXPECT(node.device.registers[InstallationHeightRegister::ADDRESS] == 200);
+	EXPECT(node.device.registers[RangeRegister::ADDRESS] == 20);
+
+	node.device.set_distance(1234);
+	host::run_for(5 * SECOND);
+	EXPECT(node.distances.size() >= 2);
+	EXPECT(node.sensor.get_state() == 1234.0f);
+	EXPECT(node.depth.get_state() == 766.0f);
+	EXPECT(node.sensor.block_reads_);
+	EXPECT(host::count_log("", ESPHOME_LOG_LEVEL_WARN) == 0);
+}
+
+TEST(falls_back_to_single_reads)
+{
+	Node node;
+	node.with_depth();
+	node.device.disable_block_reads();
+	node.device.set_distance(500);
+	EXPECT(node.start());
+
+	EXPECT(node.read_once() > 0);
+	EXPECT(!node.sensor.block_reads_);
+	EXPECT(node.read_once() > 0);
+	EXPECT(node.sensor.get_state() == 500.0f);
+	EXPECT(node.depth.get_state() == 1500.0f);
+	// Only the first reading found out the hard way
+	EXPECT(host::count_log("doesn't support block reads", ESPHOME_LOG_LEVEL_WARN) == 1);
+}
+
+// Values outside a register's range count as wrong: a setting is rewritten,
+// a measurement isn't published
+TEST(out_of_range_values)
+{
+	Node node;
+	node.with_depth();
+	node.device.registers[RangeRegister::ADDRESS] = 60;
+	EXPECT(node.start());
+	EXPECT(node.device.registers[RangeRegister::ADDRESS] == 10);
+	EXPECT(host::count_log("Sensor's range is outside 0 to 40 m", ESPHOME_LOG_LEVEL_WARN) == 1);
+
+	node.device.set_distance(1000);
+	node.device.registers[WaterLevelRegister::ADDRESS] = 50000;
+	EXPECT(node.read_once() > 0);
+	EXPECT(node.depths.empty());
+	EXPECT(host::count_log("Ignoring water level of 50000 mm") >= 1);
+
+	node.device.registers[SpaceHeightRegister::ADDRESS] = 65535;
+	size_t published = node.distances.size();
+	EXPECT(node.read_once() == 0);
+	EXPECT(node.distances.size() == published);
+	EXPECT(host::count_log("Ignoring space height of 65535 mm") >= 1);
+}
+
+// Answers handed over in two chunks are put back together, as long as the gap
+// is within the hand-over allowance
+TEST(split_answers)
+{
+	Node node;
+	node.with_depth();
+	node.device.set_distance(800);
+	EXPECT(node.start());
+
+	node.device.faults.split = 1.0f;
+	node.device.faults.split_gap = 8 * 87;
+	uint32_t retries = node.sensor.get_link_stats().retries;
+	for (int i = 0; i < 20; i++)
+		EXPECT(node.read_once() > 0);
+	EXPECT(node.sensor.get_link_stats().retries == retries);
+	EXPECT(node.sensor.get_state() == 800.0f);
+
+	// A longer gap loses the answer, and its late tail can spoil the next attempt...
+	node.device.faults.split_gap = 5000;
+	EXPECT(node.read_once() == 0);
+	EXPECT(node.sensor.get_link_stats().results[MODBUS_INCOMPLETE] > 0);
+	// ... while a clean line reads again
+	node.device.faults.split = 0.0f;
+	EXPECT(node.read_once() > 0);
+}
+
+// On a bad line every published value is still one the sensor measured
+TEST(faulty_link)
+{
+	Node node(115200, 7);
+	node.with_depth();
+	node.sensor.set_update_interval(1000);
+	sensor::Sensor errors{"link errors"};
+	sensor::Sensor timeouts{"link timeouts"};
+	node.sensor.set_link_errors_sensor(&errors);
+	node.sensor.set_link_timeouts_sensor(&timeouts);
+	EXPECT(node.start());
+
+	node.device.faults.no_answer = 0.05f;
+	node.device.faults.drop_byte = 0.05f;
+	node.device.faults.corrupt = 0.05f;
+	node.device.faults.split = 0.05f;
+	node.device.faults.split_gap = 3000;
+
+	std::set<float> measured;
+	for (int i = 0; i < 600; i++)
+	{
+		uint16_t distance = 500 + (i * 37) % 1000;
+		node.device.set_distance(distance);
+		measured.insert(distance);
+		host::run_for(SECOND);
+	}
+
+	for (auto &reading : node.distances)
+		EXPECT(measured.count(reading.value) == 1);
+	for (auto &reading : node.depths)
+		EXPECT(measured.count(2000 - reading.value) == 1);
+	EXPECT(node.distances.size() >= 590);
+	EXPECT(node.device.faults_injected > 0);
+
+	const ModbusStats &stats = node.sensor.get_link_stats();
+	EXPECT(stats.retries > 0);
+	EXPECT(stats.results[MODBUS_NO_RESPONSE] > 0);
+	EXPECT(stats.results[MODBUS_CRC_ERROR] + stats.results[MODBUS_INCOMPLETE] > 0);
+	for (uint8_t result = 0; result < MODBUS_RESULT_COUNT; result++)
+		EXPECT(stats.read_results[result] + stats.write_results[result] == stats.results[result]);
+	EXPECT(stats.read_results[MODBUS_OK] >= 590);
+
+	// The counts since boot are published with the next update
+	node.device.faults = LinkFaults();
+	host::run_for(2 * SECOND);
+	EXPECT(timeouts.get_state() == stats.timeouts() && stats.timeouts() > 0);
+	EXPECT(errors.get_state() == stats.errors() && stats.errors() > 0);
+}
+
+// A sensor that stops answering is backed off, and read again once it's back
+TEST(outage_and_recovery)
+{
+	Node node;
+	node.sensor.set_update_interval(1000);
+	EXPECT(node.start());
+	host::run_for(5 * SECOND);
+
+	node.device.dead = true;
+	uint32_t requests = node.device.requests;
+	host::run_for(60 * SECOND);
+	EXPECT(node.sensor.is_isolated());
+	uint32_t requests_while_dead = node.device.requests - requests;
+
+	node.device.dead = false;
+	size_t before = node.distances.size();
+	uint64_t back = host::now();
+	EXPECT(host::run_until([&]()
+						   { return node.distances.size() > before; },
+						   120 * SECOND));
+	EXPECT(!node.sensor.is_isolated());
+	EXPECT(host::now() - back < 90 * SECOND);
+	// Isolation keeps a dead sensor from taking the bus every second
+	EXPECT(requests_while_dead < 20);
+}
+
+TEST(burst_median)
+{
+	Node node;
+	node.sensor.set_burst(7, BURST_MEDIAN);
+	node.device.set_distance(1500);
+	EXPECT(node.start());
+
+	uint32_t requests = node.device.requests;
+	EXPECT(node.read_once() > 0);
+	EXPECT(node.device.requests - requests == 7);
+	EXPECT(node.sensor.get_state() == 1500.0f);
+}
+
+TEST(burst_queue_full)
+{
+	Node node;
+	node.sensor.set_burst(7, BURST_MEDIAN);
+	node.device.set_distance(1500);
+	EXPECT(node.start());
+
+	uint32_t queued = 0;
+	uint32_t answered = 0;
+	auto fill_queue = [&]()
+	{
+		while (node.bus.read_registers(&node.sensor, RangeRegister::ADDRESS, 1, [&answered](const ModbusResponse &response)
+									   { answered++; }))
+			queued++;
+	};
+
+	// No room for the first read: the update is skipped, and says so
+	fill_queue();
+	node.sensor.request_measurement();
+	EXPECT(!node.sensor.reading_);
+	EXPECT(host::count_log("Bus queue full, skipping this update", 2) == 1);
+	EXPECT(host::run_until([&]()
+						   { return answered == queued; },
+						   1000000));
+
+	// No room for the next read of a burst: what was read so far is published
+	size_t publishes = node.distances.size();
+	fill_queue();
+	node.sensor.samples_taken_ = 0;
+	node.sensor.valid_samples_ = 0;
+	ModbusResponse response{};
+	response.result = MODBUS_OK;
+	response.count = 1;
+	response.values[0] = 1234;
+	node.sensor.handle_sample(response);
+	EXPECT(host::count_log("ending the burst after 1 of 7 samples", 2) == 1);
+	EXPECT(node.distances.size() == publishes + 1);
+	EXPECT(node.sensor.get_state() == 1234.0f);
+}
+
+TEST(busy_retry_delay)
+{
+	Node node;
+	EXPECT(node.start());
+
+	std::vector<uint64_t> sent;
+	node.uart.add_on_transmit_callback([&sent](const uint8_t *data, size_t len)
+									   { sent.push_back(host::now()); });
+
+	// Busy on every attempt, then an unrelated request queued behind it
+	node.device.busy = 3;
+	ModbusResult first = MODBUS_OK;
+	ModbusResult second = MODBUS_EXCEPTION;
+	node.bus.read_registers(&node.sensor, RangeRegister::ADDRESS, 1, [&first](const ModbusResponse &response)
+							{ first = response.result; });
+	bool done = false;
+	node.bus.read_registers(&node.sensor, RangeRegister::ADDRESS, 1, [&second, &done](const ModbusResponse &response)
+							{
+								second = response.result;
+								done = true;
+							});
+	EXPECT(host::run_until([&done]()
+						   { return done; },
+						   1000000));
+	EXPECT(first == MODBUS_EXCEPTION);
+	EXPECT(second == MODBUS_OK);
+	EXPECT(sent.size() == 4);
+	if (sent.size() != 4)
+		return;
+
+	// The retries wait for the busy device, the next request doesn't
+	EXPECT(sent[1] - sent[0] > 20000);
+	EXPECT(sent[2] - sent[1] > 20000);
+	EXPECT(sent[3] - sent[2] < 5000);
+}
+
+TEST(level_change_follow_up)
+{
+	Node node;
+	node.sensor.set_update_interval(60000);
+	node.sensor.set_change_threshold(10.0f);
+	node.sensor.set_adaptive_polling(10000, 60000);
+	// Separate water level reads, so the follow-up has to wait for one
+	node.with_depth();
+	node.device.disable_block_reads();
+	node.device.set_distance(1500);
+	EXPECT(node.start());
+	host::run_for(130000000);
+	EXPECT(node.sensor.get_update_interval() == 60000);
+
+	// The change is read again as soon as the water level read is done, not
+	// after the restarted poller's random offset of up to 5s
+	node.device.set_distance(1400);
+	EXPECT(host::run_until([&node]()
+						   { return !node.distances.empty() && node.distances.back().value == 1400.0f; },
+						   70000000));
+	uint64_t changed = host::now();
+	size_t publishes = node.distances.size();
+	EXPECT(node.sensor.get_update_interval() == 10000);
+	EXPECT(host::run_until([&node, publishes]()
+						   { return node.distances.size() > publishes; },
+						   10000000));
+	EXPECT(host::now() - changed < 100000);
+	EXPECT(host::count_log("still in progress", 2) == 0);
+}
+
+int main(int argc, char **argv) { return testing::run_tests(argc, argv); }
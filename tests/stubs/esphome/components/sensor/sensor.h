@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#define LOG_SENSOR(prefix, type, obj) ::esphome::sensor::log_sensor(TAG, prefix, type, obj)
+
+namespace esphome
+{
+	namespace sensor
+	{
+
+		class Sensor
+		{
+		public:
+			explicit Sensor(const std::string &name = "sensor") : name_(name) {}
+
+			void publish_state(float state)
+			{
+				this->state = state;
+				this->has_state_ = true;
+				this->publish_count_++;
+				this->callback_.call(state);
+			}
+			void add_on_state_callback(std::function<void(float)> &&callback) { this->callback_.add(std::move(callback)); }
+
+			float get_state() const { return this->state; }
+			bool has_state() const { return this->has_state_; }
+			uint32_t get_publish_count() const { return this->publish_count_; }
+			const std::string &get_name() const { return this->name_; }
+			uint32_t get_object_id_hash() const { return fnv1_hash(this->name_); }
+
+			float state{NAN};
+
+		protected:
+			std::string name_;
+			bool has_state_{false};
+			uint32_t publish_count_{0};
+			CallbackManager<void(float)> callback_;
+		};
+
+		inline void log_sensor(const char *tag, const char *prefix, const char *type, const Sensor *obj)
+		{
+			if (obj != nullptr)
+			{
+				ESP_LOGCONFIG(tag, "%s%s '%s'", prefix, type, obj->get_name().c_str());
+			}
+		}
+
+	} // namespace sensor
+} // namespace esphome
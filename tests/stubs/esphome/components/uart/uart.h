@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+#include "esphome/core/component.h"
+
+namespace esphome
+{
+	namespace uart
+	{
+
+		enum UARTParityOptions
+		{
+			UART_CONFIG_PARITY_NONE,
+			UART_CONFIG_PARITY_EVEN,
+			UART_CONFIG_PARITY_ODD,
+		};
+
+		// Host build: the far end of the line is test code. What the component
+		// writes goes to the transmit callbacks, and bytes queued with
+		// receive_at() become readable once the simulated clock reaches them.
+		class UARTComponent
+		{
+		public:
+			void write_array(const uint8_t *data, size_t len);
+			bool peek_byte(uint8_t *data);
+			bool read_array(uint8_t *data, size_t len);
+			int available();
+			void flush() {}
+
+			void set_baud_rate(uint32_t baud_rate) { this->baud_rate_ = baud_rate; }
+			uint32_t get_baud_rate() const { return this->baud_rate_; }
+			uint8_t get_stop_bits() const { return 1; }
+			uint8_t get_data_bits() const { return 8; }
+			UARTParityOptions get_parity() const { return UART_CONFIG_PARITY_NONE; }
+			virtual void load_settings(bool dump_config = true) {}
+
+			// Called with every write, at the time the first byte goes out
+			void add_on_transmit_callback(std::function<void(const uint8_t *data, size_t len)> &&callback)
+			{
+				this->transmit_callbacks_.push_back(std::move(callback));
+			}
+			// Make a byte readable at a simulated time (us). Bytes queued for the
+			// same time are read in the order they were queued.
+			void receive_at(uint64_t time, uint8_t data) { this->incoming_.emplace(time, data); }
+			void receive_at(uint64_t time, const uint8_t *data, size_t len)
+			{
+				for (size_t i = 0; i < len; i++)
+					this->receive_at(time, data[i]);
+			}
+			// Drop everything received or still on its way
+			void clear();
+
+			uint64_t get_bytes_written() const { return this->bytes_written_; }
+			uint64_t get_bytes_read() const { return this->bytes_read_; }
+
+		protected:
+			void deliver();
+
+			uint32_t baud_rate_{115200};
+			std::multimap<uint64_t, uint8_t> incoming_;
+			std::deque<uint8_t> rx_;
+			std::vector<std::function<void(const uint8_t *, size_t)>> transmit_callbacks_;
+			uint64_t bytes_written_{0};
+			uint64_t bytes_read_{0};
+		};
+
+		class UARTDevice
+		{
+		public:
+			UARTDevice() = default;
+			UARTDevice(UARTComponent *parent) : parent_(parent) {}
+
+			void set_uart_parent(UARTComponent *parent) { this->parent_ = parent; }
+
+			void write_byte(uint8_t data) { this->parent_->write_array(&data, 1); }
+			void write_array(const uint8_t *data, size_t len) { this->parent_->write_array(data, len); }
+			void write_array(const std::vector<uint8_t> &data) { this->parent_->write_array(data.data(), data.size()); }
+			bool read_byte(uint8_t *data) { return this->parent_->read_array(data, 1); }
+			bool peek_byte(uint8_t *data) { return this->parent_->peek_byte(data); }
+			bool read_array(uint8_t *data, size_t len) { return this->parent_->read_array(data, len); }
+			int available() { return this->parent_->available(); }
+			int read()
+			{
+				uint8_t data;
+				return this->read_byte(&data) ? data : -1;
+			}
+			void flush() { this->parent_->flush(); }
+			void check_uart_settings(uint32_t baud_rate, uint8_t stop_bits = 1,
+									 UARTParityOptions parity = UART_CONFIG_PARITY_NONE, uint8_t data_bits = 8)
+			{
+			}
+
+		protected:
+			UARTComponent *parent_{nullptr};
+		};
+
+	} // namespace uart
+} // namespace esphome
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+
+namespace esphome
+{
+
+	template <typename... Ts>
+	class Trigger
+	{
+	public:
+		void trigger(Ts... x) { this->fired_++; }
+		int fired() const { return this->fired_; }
+
+	protected:
+		int fired_{0};
+	};
+
+	template <typename... Ts>
+	class Action
+	{
+	public:
+		virtual ~Action() = default;
+		virtual void play(Ts... x) = 0;
+	};
+
+} // namespace esphome
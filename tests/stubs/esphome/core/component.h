@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "esphome/core/hal.h"
+
+namespace esphome
+{
+
+	namespace setup_priority
+	{
+		extern const float BUS;
+		extern const float IO;
+		extern const float HARDWARE;
+		extern const float DATA;
+		extern const float PROCESSOR;
+		extern const float AFTER_WIFI;
+		extern const float LATE;
+	} // namespace setup_priority
+
+	// Host build: the scheduler behind set_interval() and set_timeout() runs on
+	// the simulated clock, see host.h
+	class Component
+	{
+	public:
+		virtual ~Component() = default;
+
+		virtual void setup() {}
+		virtual void loop() {}
+		virtual void dump_config() {}
+		virtual float get_setup_priority() const { return 0.0f; }
+		virtual void call_setup() { this->setup(); }
+
+		void mark_failed() { this->failed_ = true; }
+		bool is_failed() const { return this->failed_; }
+		void status_set_warning(const char *message = "unspecified") { this->warning_ = true; }
+		void status_clear_warning() { this->warning_ = false; }
+		bool status_has_warning() const { return this->warning_; }
+
+	protected:
+		// Intervals start after a random offset of up to half the interval, like on the device
+		void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f);
+		void set_interval(uint32_t interval, std::function<void()> &&f);
+		bool cancel_interval(const std::string &name);
+		void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f);
+		void set_timeout(uint32_t timeout, std::function<void()> &&f);
+		bool cancel_timeout(const std::string &name);
+		void defer(std::function<void()> &&f) { this->set_timeout(0, std::move(f)); }
+
+		bool failed_{false};
+		bool warning_{false};
+	};
+
+	class PollingComponent : public Component
+	{
+	public:
+		PollingComponent() : PollingComponent(0) {}
+		explicit PollingComponent(uint32_t update_interval) : update_interval_(update_interval) {}
+
+		virtual void set_update_interval(uint32_t update_interval) { this->update_interval_ = update_interval; }
+		virtual uint32_t get_update_interval() const { return this->update_interval_; }
+		virtual void update() = 0;
+
+		void call_setup() override
+		{
+			this->setup();
+			this->start_poller();
+		}
+		void start_poller() { this->set_interval("update", this->get_update_interval(), [this]() { this->update(); }); }
+		void stop_poller() { this->cancel_interval("update"); }
+
+	protected:
+		uint32_t update_interval_;
+	};
+
+} // namespace esphome
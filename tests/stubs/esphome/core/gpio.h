@@ -0,0 +1,21 @@
+#pragma once
+
+#define LOG_PIN(prefix, pin) (void) (pin)
+
+namespace esphome
+{
+
+	// Host build: a pin that remembers what was written to it
+	class GPIOPin
+	{
+	public:
+		virtual ~GPIOPin() = default;
+		virtual void setup() {}
+		virtual void digital_write(bool value) { this->state_ = value; }
+		virtual bool digital_read() { return this->state_; }
+
+	protected:
+		bool state_{false};
+	};
+
+} // namespace esphome
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Host build: time comes from the simulated clock in host.h
+namespace esphome
+{
+
+	uint32_t millis();
+	uint32_t micros();
+	void delay(uint32_t ms);
+	void delayMicroseconds(uint32_t us);
+	void yield();
+
+} // namespace esphome
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace esphome
+{
+
+	uint32_t fnv1_hash(const std::string &str);
+	// Deterministic on the host, see host::seed()
+	uint32_t random_uint32();
+	std::string format_hex_pretty(const uint8_t *data, size_t length);
+
+	template <typename T>
+	class Parented
+	{
+	public:
+		Parented() {}
+		Parented(T *parent) : parent_(parent) {}
+
+		T *get_parent() const { return this->parent_; }
+		void set_parent(T *parent) { this->parent_ = parent; }
+
+	protected:
+		T *parent_{nullptr};
+	};
+
+	// The host loop always runs at full speed, this only records the request
+	class HighFrequencyLoopRequester
+	{
+	public:
+		void start() { this->started_ = true; }
+		void stop() { this->started_ = false; }
+		bool is_started() const { return this->started_; }
+
+	protected:
+		bool started_{false};
+	};
+
+	template <typename T>
+	class CallbackManager;
+
+	template <typename... Ts>
+	class CallbackManager<void(Ts...)>
+	{
+	public:
+		void add(std::function<void(Ts...)> &&callback) { this->callbacks_.push_back(std::move(callback)); }
+		void call(Ts... args)
+		{
+			for (auto &callback : this->callbacks_)
+				callback(args...);
+		}
+		size_t size() const { return this->callbacks_.size(); }
+
+	protected:
+		std::vector<std::function<void(Ts...)>> callbacks_;
+	};
+
+} // namespace esphome
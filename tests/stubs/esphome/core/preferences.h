@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace esphome
+{
+
+	// Host build: preferences live in memory until host::reset()
+	class ESPPreferenceObject
+	{
+	public:
+		ESPPreferenceObject() = default;
+		ESPPreferenceObject(std::vector<uint8_t> *data, size_t size) : data_(data), size_(size) {}
+
+		template <typename T>
+		bool save(const T *src)
+		{
+			if (this->data_ == nullptr || sizeof(T) != this->size_)
+				return false;
+			this->data_->assign(reinterpret_cast<const uint8_t *>(src), reinterpret_cast<const uint8_t *>(src) + sizeof(T));
+			return true;
+		}
+
+		template <typename T>
+		bool load(T *dest)
+		{
+			if (this->data_ == nullptr || sizeof(T) != this->size_ || this->data_->size() != sizeof(T))
+				return false;
+			memcpy(dest, this->data_->data(), sizeof(T));
+			return true;
+		}
+
+	protected:
+		std::vector<uint8_t> *data_{nullptr};
+		size_t size_{0};
+	};
+
+	class ESPPreferences
+	{
+	public:
+		template <typename T>
+		ESPPreferenceObject make_preference(uint32_t type, bool in_flash = false)
+		{
+			return ESPPreferenceObject(&this->store_[type], sizeof(T));
+		}
+		bool sync() { return true; }
+		void reset() { this->store_.clear(); }
+		size_t size() const { return this->store_.size(); }
+
+	protected:
+		std::map<uint32_t, std::vector<uint8_t>> store_;
+	};
+
+	extern ESPPreferences *global_preferences;
+
+} // namespace esphome
@@ -0,0 +1,345 @@
+#include "host.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/uart/uart.h"
+
+namespace esphome
+{
+
+	namespace setup_priority
+	{
+		const float BUS = 1000.0f;
+		const float IO = 900.0f;
+		const float HARDWARE = 800.0f;
+		const float DATA = 600.0f;
+		const float PROCESSOR = 400.0f;
+		const float AFTER_WIFI = 200.0f;
+		const float LATE = -100.0f;
+	} // namespace setup_priority
+
+	namespace
+	{
+		struct Timer
+		{
+			Component *component;
+			std::string name; // Empty for anonymous timers, they can't be cancelled
+			bool interval;
+			uint32_t period; // us
+			uint64_t next;
+			uint64_t order;
+			std::function<void()> callback;
+			bool removed;
+		};
+
+		struct LogEntry
+		{
+			int level;
+			std::string message;
+		};
+
+		const size_t MAX_LOG_ENTRIES = 100000;
+
+		uint64_t now_us = 0;
+		uint32_t loop_time_us = 100;
+		uint32_t random_state = 1;
+		uint64_t timer_order = 0;
+		std::vector<std::unique_ptr<Timer>> timers;
+		std::vector<Component *> components;
+		ESPPreferences preferences;
+		int print_level = ESPHOME_LOG_LEVEL_NONE;
+		std::vector<LogEntry> log_entries;
+
+		void add_timer(Component *component, const std::string &name, bool interval, uint32_t period,
+					   std::function<void()> &&callback)
+		{
+			for (auto &timer : timers)
+			{
+				if (!name.empty() && timer->component == component && timer->interval == interval && timer->name == name)
+					timer->removed = true;
+			}
+			uint64_t delay = (uint64_t) period * 1000;
+			if (interval && period != 0)
+			{
+				// Like the device's scheduler, spread intervals over the first half period
+				delay = (uint64_t) (random_uint32() % period / 2) * 1000;
+			}
+			timers.push_back(std::unique_ptr<Timer>(
+				new Timer{component, name, interval, period * 1000, now_us + delay, timer_order++, std::move(callback), false}));
+		}
+
+		bool remove_timer(Component *component, const std::string &name, bool interval)
+		{
+			bool found = false;
+			for (auto &timer : timers)
+			{
+				if (!timer->removed && timer->component == component && timer->interval == interval && timer->name == name)
+				{
+					timer->removed = true;
+					found = true;
+				}
+			}
+			return found;
+		}
+
+		// Earliest due timer, in the order they were set for the same time
+		Timer *next_due_timer()
+		{
+			Timer *next = nullptr;
+			for (auto &timer : timers)
+			{
+				if (timer->removed || timer->next > now_us)
+					continue;
+				if (next == nullptr || timer->next < next->next || (timer->next == next->next && timer->order < next->order))
+					next = timer.get();
+			}
+			return next;
+		}
+
+		void run_timers()
+		{
+			// Timers set from a callback with no delay run in the next pass, not this one
+			uint64_t last_order = timer_order;
+			while (Timer *timer = next_due_timer())
+			{
+				if (timer->order >= last_order)
+					break;
+				std::function<void()> callback = timer->callback;
+				if (timer->interval)
+				{
+					timer->next = now_us + std::max<uint64_t>(timer->period, 1);
+					timer->order = timer_order++;
+				}
+				else
+				{
+					timer->removed = true;
+				}
+				callback();
+			}
+			timers.erase(std::remove_if(timers.begin(), timers.end(), [](const std::unique_ptr<Timer> &timer)
+										{ return timer->removed; }),
+						 timers.end());
+		}
+	} // namespace
+
+	ESPPreferences *global_preferences = &preferences;
+
+	uint32_t millis() { return (uint32_t) (now_us / 1000); }
+	uint32_t micros() { return (uint32_t) now_us; }
+	void delay(uint32_t ms) { now_us += (uint64_t) ms * 1000; }
+	void delayMicroseconds(uint32_t us) { now_us += us; }
+	void yield() {}
+
+	uint32_t fnv1_hash(const std::string &str)
+	{
+		uint32_t hash = 2166136261UL;
+		for (char c : str)
+		{
+			hash *= 16777619UL;
+			hash ^= (uint8_t) c;
+		}
+		return hash;
+	}
+
+	uint32_t random_uint32()
+	{
+		// xorshift32
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		return random_state;
+	}
+
+	std::string format_hex_pretty(const uint8_t *data, size_t length)
+	{
+		std::string result;
+		char buffer[4];
+		for (size_t i = 0; i < length; i++)
+		{
+			snprintf(buffer, sizeof(buffer), i == 0 ? "%02X" : ".%02X", data[i]);
+			result += buffer;
+		}
+		if (length > 4)
+			result += " (" + std::to_string(length) + ")";
+		return result;
+	}
+
+	void esp_log_printf_(int level, const char *tag, int line, const char *format, ...)
+	{
+		char buffer[512];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+
+		if (level <= print_level)
+		{
+			static const char LEVEL_LETTERS[] = "NEWICDVV";
+			printf("[%10.3f][%c][%s:%d]: %s\n", now_us / 1000.0, LEVEL_LETTERS[level], tag, line, buffer);
+		}
+		if (log_entries.size() >= MAX_LOG_ENTRIES)
+			log_entries.erase(log_entries.begin(), log_entries.begin() + MAX_LOG_ENTRIES / 2);
+		log_entries.push_back({level, buffer});
+	}
+
+	void Component::set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f)
+	{
+		add_timer(this, name, true, interval, std::move(f));
+	}
+	void Component::set_interval(uint32_t interval, std::function<void()> &&f) { add_timer(this, "", true, interval, std::move(f)); }
+	bool Component::cancel_interval(const std::string &name) { return remove_timer(this, name, true); }
+	void Component::set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f)
+	{
+		add_timer(this, name, false, timeout, std::move(f));
+	}
+	void Component::set_timeout(uint32_t timeout, std::function<void()> &&f) { add_timer(this, "", false, timeout, std::move(f)); }
+	bool Component::cancel_timeout(const std::string &name) { return remove_timer(this, name, false); }
+
+	namespace uart
+	{
+		void UARTComponent::write_array(const uint8_t *data, size_t len)
+		{
+			this->bytes_written_ += len;
+			for (auto &callback : this->transmit_callbacks_)
+				callback(data, len);
+		}
+
+		void UARTComponent::deliver()
+		{
+			while (!this->incoming_.empty() && this->incoming_.begin()->first <= now_us)
+			{
+				this->rx_.push_back(this->incoming_.begin()->second);
+				this->incoming_.erase(this->incoming_.begin());
+			}
+		}
+
+		bool UARTComponent::peek_byte(uint8_t *data)
+		{
+			this->deliver();
+			if (this->rx_.empty())
+				return false;
+			*data = this->rx_.front();
+			return true;
+		}
+
+		bool UARTComponent::read_array(uint8_t *data, size_t len)
+		{
+			this->deliver();
+			if (this->rx_.size() < len)
+				return false;
+			std::copy(this->rx_.begin(), this->rx_.begin() + len, data);
+			this->rx_.erase(this->rx_.begin(), this->rx_.begin() + len);
+			this->bytes_read_ += len;
+			return true;
+		}
+
+		int UARTComponent::available()
+		{
+			this->deliver();
+			return (int) this->rx_.size();
+		}
+
+		void UARTComponent::clear()
+		{
+			this->incoming_.clear();
+			this->rx_.clear();
+		}
+	} // namespace uart
+
+	namespace host
+	{
+
+		void reset(uint32_t seed)
+		{
+			now_us = 0;
+			loop_time_us = 100;
+			random_state = seed != 0 ? seed : 1;
+			timer_order = 0;
+			timers.clear();
+			components.clear();
+			preferences.reset();
+			log_entries.clear();
+			const char *level = getenv("HOST_LOG_LEVEL");
+			print_level = level != nullptr ? atoi(level) : ESPHOME_LOG_LEVEL_NONE;
+		}
+
+		uint64_t now() { return now_us; }
+
+		void register_component(Component *component) { components.push_back(component); }
+
+		void setup()
+		{
+			for (auto *component : components)
+				component->call_setup();
+			for (auto *component : components)
+				component->dump_config();
+		}
+
+		void loop_once()
+		{
+			run_timers();
+			for (auto *component : components)
+				component->loop();
+			now_us += loop_time_us;
+		}
+
+		void set_loop_time(uint32_t loop_time) { loop_time_us = loop_time; }
+
+		void advance(uint64_t duration) { now_us += duration; }
+
+		void run_for(uint64_t duration)
+		{
+			uint64_t end = now_us + duration;
+			while (now_us < end)
+				loop_once();
+		}
+
+		bool run_until(const std::function<bool()> &done, uint64_t timeout)
+		{
+			uint64_t end = now_us + timeout;
+			while (!done())
+			{
+				if (now_us >= end)
+					return false;
+				loop_once();
+			}
+			return true;
+		}
+
+		void set_log_level(int level) { print_level = level; }
+
+		size_t count_log(const char *text, int level)
+		{
+			size_t count = 0;
+			for (auto &entry : log_entries)
+			{
+				if (entry.level <= level && entry.message.find(text) != std::string::npos)
+					count++;
+			}
+			return count;
+		}
+
+		std::vector<std::string> find_log(const char *text, int level)
+		{
+			std::vector<std::string> found;
+			for (auto &entry : log_entries)
+			{
+				if (entry.level <= level && entry.message.find(text) != std::string::npos)
+					found.push_back(entry.message);
+			}
+			return found;
+		}
+
+		void clear_log() { log_entries.clear(); }
+
+	} // namespace host
+} // namespace esphome
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "esphome/core/component.h"
+
+// Control of the host build: a simulated clock, the main loop and the
+// scheduler, and the log. Nothing here sleeps, a minute of device time runs in
+// a few milliseconds and every run with the same seed is identical.
+namespace esphome
+{
+	namespace host
+	{
+
+		// Start over at time 0 with no components, timers, preferences or logs
+		void reset(uint32_t seed = 1);
+
+		// Simulated time in us since reset()
+		uint64_t now();
+
+		// Components are set up, dump their configuration and take part in every
+		// loop pass, in the order registered
+		void register_component(Component *component);
+		void setup();
+
+		// One pass of the main loop: due timers, then every component's loop(). The
+		// clock then moves on by the loop time, 100us unless changed.
+		void loop_once();
+		void set_loop_time(uint32_t loop_time);
+		void run_for(uint64_t duration);
+		// Moves the clock on without running anything
+		void advance(uint64_t duration);
+		// Runs until done() returns true, false if it didn't within the timeout (us)
+		bool run_until(const std::function<bool()> &done, uint64_t timeout);
+
+		// Messages at this level or more important are printed. None unless the
+		// HOST_LOG_LEVEL environment variable sets a level (2 for warnings, 5 for debug).
+		void set_log_level(int level);
+		// Messages logged since reset() or clear_log() containing text, at this level or more important
+		size_t count_log(const char *text, int level = 7);
+		std::vector<std::string> find_log(const char *text, int level = 7);
+		void clear_log();
+
+	} // namespace host
+} // namespace esphome
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "host.h"
+
+// Minimal test runner. TEST() registers a case; run_tests() runs them all,
+// or the ones named on the command line, each from a fresh host::reset().
+namespace testing
+{
+
+	struct TestCase
+	{
+		const char *name;
+		void (*run)();
+	};
+
+	inline std::vector<TestCase> &registry()
+	{
+		static std::vector<TestCase> cases;
+		return cases;
+	}
+
+	inline int &failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	struct Registrar
+	{
+		Registrar(const char *name, void (*run)()) { registry().push_back({name, run}); }
+	};
+
+	inline void fail(const char *file, int line, const char *expression)
+	{
+		printf("%s:%d: FAILED: %s\n", file, line, expression);
+		failures()++;
+	}
+
+	inline int run_tests(int argc, char **argv)
+	{
+		int failed_cases = 0;
+		int run = 0;
+		for (const TestCase &test : registry())
+		{
+			bool selected = argc < 2;
+			for (int i = 1; i < argc; i++)
+				selected |= strcmp(argv[i], test.name) == 0;
+			if (!selected)
+				continue;
+
+			esphome::host::reset();
+			int before = failures();
+			test.run();
+			run++;
+			bool passed = failures() == before;
+			failed_cases += passed ? 0 : 1;
+			printf("[%s] %s\n", passed ? "PASS" : "FAIL", test.name);
+		}
+		if (run == 0)
+		{
+			printf("No test matched\n");
+			return 1;
+		}
+		printf("%d of %d passed\n", run - failed_cases, run);
+		return failed_cases == 0 ? 0 : 1;
+	}
+
+} // namespace testing
+
+#define TEST(name)                                                  \
+	static void name();                                             \
+	static testing::Registrar name##_registrar(#name, name);        \
+	static void name()
+
+#define EXPECT(condition)                                           \
+	do                                                              \
+	{                                                               \
+		if (!(condition))                                           \
+			testing::fail(__FILE__, __LINE__, #condition);          \
+	} while (0)
+
+#define EXPECT_NEAR(actual, expected, tolerance) EXPECT(std::fabs((double) (actual) - (double) (expected)) <= (tolerance))